@@ -1,36 +1,520 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <stdio.h>
 #include <thread>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <string>
 #include <atomic>
 #include <stdexcept>
 #include <algorithm>
+#include <chrono>
+#include <memory>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHUNK_KERNELS_X86 1
+#endif
+
+// 向量化的块处理函数，可直接在 process_parallel 的处理函数中调用。
+// 启动时按 CPU 支持选择 AVX-512 / AVX2 / SSE2 实现，其他平台使用标量实现。
+class ChunkKernels {
+public:
+    // 统计等于 value 的字节数
+    static size_t count_byte(const char* data, size_t size, char value) {
+        return table().count_byte(data, size, value);
+    }
+
+    // 统计非零字节数
+    static size_t count_nonzero(const char* data, size_t size) {
+        return size - count_byte(data, size, 0);
+    }
+
+    // 查找第一个等于 value 的字节（类似 memchr），没有返回 nullptr
+    static const char* find_byte(const char* data, size_t size, char value) {
+        return table().find_byte(data, size, value);
+    }
+
+    // 依次回调每个分隔符的位置，回调返回 false 时停止
+    template<typename Func>
+    static void for_each_delimiter(const char* data, size_t size, char delimiter, Func callback) {
+        const char* end = data + size;
+        while (data < end) {
+            const char* found = find_byte(data, end - data, delimiter);
+            if (!found || !callback(found)) break;
+            data = found + 1;
+        }
+    }
+
+    // 字节直方图，结果累加到 counts 中
+    static void histogram(const char* data, size_t size, uint64_t counts[256]) {
+        table().histogram(data, size, counts);
+    }
+
+    // 每个字节加上 delta
+    static void add_bytes(char* data, size_t size, char delta) {
+        table().add_bytes(data, size, delta);
+    }
+
+    // 每个字节与 key 异或
+    static void xor_bytes(char* data, size_t size, char key) {
+        table().xor_bytes(data, size, key);
+    }
+
+    // 校验和：按小端 64 位字累加，末尾不足 8 字节按字节累加。
+    // 与顺序无关，各块结果相加即为整个文件的校验和（块大小需为 8 的倍数）
+    static uint64_t checksum(const char* data, size_t size) {
+        return table().checksum(data, size);
+    }
+
+    // 当前使用的指令集
+    static const char* isa() {
+        return table().name;
+    }
+
+private:
+    struct Table {
+        const char* name;
+        size_t (*count_byte)(const char*, size_t, char);
+        const char* (*find_byte)(const char*, size_t, char);
+        void (*histogram)(const char*, size_t, uint64_t*);
+        void (*add_bytes)(char*, size_t, char);
+        void (*xor_bytes)(char*, size_t, char);
+        uint64_t (*checksum)(const char*, size_t);
+    };
+
+    // 首次调用时选择实现
+    static const Table& table() {
+        static const Table selected = select();
+        return selected;
+    }
+
+    static Table select() {
+#ifdef CHUNK_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw")) {
+            return {"avx512", count_byte_avx512, find_byte_avx512, histogram_scalar,
+                    add_bytes_avx512, xor_bytes_avx512, checksum_avx512};
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return {"avx2", count_byte_avx2, find_byte_avx2, histogram_scalar,
+                    add_bytes_avx2, xor_bytes_avx2, checksum_avx2};
+        }
+        return {"sse2", count_byte_sse2, find_byte_sse2, histogram_scalar,
+                add_bytes_sse2, xor_bytes_sse2, checksum_sse2};
+#else
+        return {"scalar", count_byte_scalar, find_byte_scalar, histogram_scalar,
+                add_bytes_scalar, xor_bytes_scalar, checksum_scalar};
+#endif
+    }
+
+    // 标量实现，同时用于处理向量实现剩余的尾部
+    static size_t count_byte_scalar(const char* data, size_t size, char value) {
+        size_t count = 0;
+        for (size_t i = 0; i < size; ++i) {
+            count += data[i] == value;
+        }
+        return count;
+    }
+
+    static const char* find_byte_scalar(const char* data, size_t size, char value) {
+        return static_cast<const char*>(memchr(data, value, size));
+    }
+
+    // 直方图没有合适的向量指令，使用 4 张子表避免相邻相同字节的写后读依赖
+    static void histogram_scalar(const char* data, size_t size, uint64_t* counts) {
+        uint32_t sub[4][256] = {};
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+        while (size > 0) {
+            // 子表计数为 32 位，每轮最多处理 4G 字节
+            size_t n = std::min<size_t>(size, 1ULL << 32);
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                sub[0][p[i]]++;
+                sub[1][p[i + 1]]++;
+                sub[2][p[i + 2]]++;
+                sub[3][p[i + 3]]++;
+            }
+            for (; i < n; ++i) {
+                sub[0][p[i]]++;
+            }
+            for (int b = 0; b < 256; ++b) {
+                counts[b] += (uint64_t)sub[0][b] + sub[1][b] + sub[2][b] + sub[3][b];
+                sub[0][b] = sub[1][b] = sub[2][b] = sub[3][b] = 0;
+            }
+            p += n;
+            size -= n;
+        }
+    }
+
+    static void add_bytes_scalar(char* data, size_t size, char delta) {
+        for (size_t i = 0; i < size; ++i) {
+            data[i] += delta;
+        }
+    }
+
+    static void xor_bytes_scalar(char* data, size_t size, char key) {
+        for (size_t i = 0; i < size; ++i) {
+            data[i] ^= key;
+        }
+    }
+
+    static uint64_t checksum_scalar(const char* data, size_t size) {
+        uint64_t sum = 0;
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            sum += word;
+        }
+        for (; i < size; ++i) {
+            sum += static_cast<unsigned char>(data[i]);
+        }
+        return sum;
+    }
+
+#ifdef CHUNK_KERNELS_X86
+    // SSE2 实现，x86-64 上总是可用
+    static size_t count_byte_sse2(const char* data, size_t size, char value) {
+        __m128i target = _mm_set1_epi8(value);
+        size_t count = 0;
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, target)));
+        }
+        return count + count_byte_scalar(data + i, size - i, value);
+    }
+
+    static const char* find_byte_sse2(const char* data, size_t size, char value) {
+        __m128i target = _mm_set1_epi8(value);
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, target));
+            if (mask) return data + i + __builtin_ctz(mask);
+        }
+        return find_byte_scalar(data + i, size - i, value);
+    }
+
+    static void add_bytes_sse2(char* data, size_t size, char delta) {
+        __m128i d = _mm_set1_epi8(delta);
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i* p = reinterpret_cast<__m128i*>(data + i);
+            _mm_storeu_si128(p, _mm_add_epi8(_mm_loadu_si128(p), d));
+        }
+        add_bytes_scalar(data + i, size - i, delta);
+    }
+
+    static void xor_bytes_sse2(char* data, size_t size, char key) {
+        __m128i k = _mm_set1_epi8(key);
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i* p = reinterpret_cast<__m128i*>(data + i);
+            _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k));
+        }
+        xor_bytes_scalar(data + i, size - i, key);
+    }
+
+    static uint64_t checksum_sse2(const char* data, size_t size) {
+        __m128i sum = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            sum = _mm_add_epi64(sum, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+        }
+        uint64_t lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+        return lanes[0] + lanes[1] + checksum_scalar(data + i, size - i);
+    }
+
+    // AVX2 实现
+    __attribute__((target("avx2,popcnt")))
+    static size_t count_byte_avx2(const char* data, size_t size, char value) {
+        __m256i target = _mm256_set1_epi8(value);
+        size_t count = 0;
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            count += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, target)));
+        }
+        return count + count_byte_scalar(data + i, size - i, value);
+    }
+
+    __attribute__((target("avx2")))
+    static const char* find_byte_avx2(const char* data, size_t size, char value) {
+        __m256i target = _mm256_set1_epi8(value);
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, target));
+            if (mask) return data + i + __builtin_ctz(mask);
+        }
+        return find_byte_scalar(data + i, size - i, value);
+    }
+
+    __attribute__((target("avx2")))
+    static void add_bytes_avx2(char* data, size_t size, char delta) {
+        __m256i d = _mm256_set1_epi8(delta);
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i* p = reinterpret_cast<__m256i*>(data + i);
+            _mm256_storeu_si256(p, _mm256_add_epi8(_mm256_loadu_si256(p), d));
+        }
+        add_bytes_scalar(data + i, size - i, delta);
+    }
+
+    __attribute__((target("avx2")))
+    static void xor_bytes_avx2(char* data, size_t size, char key) {
+        __m256i k = _mm256_set1_epi8(key);
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i* p = reinterpret_cast<__m256i*>(data + i);
+            _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), k));
+        }
+        xor_bytes_scalar(data + i, size - i, key);
+    }
+
+    __attribute__((target("avx2")))
+    static uint64_t checksum_avx2(const char* data, size_t size) {
+        __m256i sum = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            sum = _mm256_add_epi64(sum, v);
+        }
+        uint64_t lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sum);
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3] + checksum_scalar(data + i, size - i);
+    }
+
+    // AVX-512 实现，字节比较和字节加法需要 AVX512BW
+    __attribute__((target("avx512f,avx512bw,popcnt")))
+    static size_t count_byte_avx512(const char* data, size_t size, char value) {
+        __m512i target = _mm512_set1_epi8(value);
+        size_t count = 0;
+        size_t i = 0;
+        for (; i + 64 <= size; i += 64) {
+            __m512i v = _mm512_loadu_si512(data + i);
+            count += __builtin_popcountll(_mm512_cmpeq_epi8_mask(v, target));
+        }
+        return count + count_byte_scalar(data + i, size - i, value);
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    static const char* find_byte_avx512(const char* data, size_t size, char value) {
+        __m512i target = _mm512_set1_epi8(value);
+        size_t i = 0;
+        for (; i + 64 <= size; i += 64) {
+            uint64_t mask = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(data + i), target);
+            if (mask) return data + i + __builtin_ctzll(mask);
+        }
+        return find_byte_scalar(data + i, size - i, value);
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    static void add_bytes_avx512(char* data, size_t size, char delta) {
+        __m512i d = _mm512_set1_epi8(delta);
+        size_t i = 0;
+        for (; i + 64 <= size; i += 64) {
+            _mm512_storeu_si512(data + i, _mm512_add_epi8(_mm512_loadu_si512(data + i), d));
+        }
+        add_bytes_scalar(data + i, size - i, delta);
+    }
+
+    __attribute__((target("avx512f")))
+    static void xor_bytes_avx512(char* data, size_t size, char key) {
+        __m512i k = _mm512_set1_epi8(key);
+        size_t i = 0;
+        for (; i + 64 <= size; i += 64) {
+            _mm512_storeu_si512(data + i, _mm512_xor_si512(_mm512_loadu_si512(data + i), k));
+        }
+        xor_bytes_scalar(data + i, size - i, key);
+    }
+
+    __attribute__((target("avx512f")))
+    static uint64_t checksum_avx512(const char* data, size_t size) {
+        __m512i sum = _mm512_setzero_si512();
+        size_t i = 0;
+        for (; i + 64 <= size; i += 64) {
+            sum = _mm512_add_epi64(sum, _mm512_loadu_si512(data + i));
+        }
+        uint64_t lanes[8];
+        _mm512_storeu_si512(lanes, sum);
+        uint64_t total = 0;
+        for (int j = 0; j < 8; ++j) {
+            total += lanes[j];
+        }
+        return total + checksum_scalar(data + i, size - i);
+    }
+#endif
+};
+
+// 单个工作线程在一次处理中的统计
+struct WorkerStats {
+    uint64_t bytes;             // 已处理字节数
+    uint64_t chunks;            // 已处理块数
+    double busy_seconds;        // 处理块的墙钟时间
+    double cpu_seconds;         // 处理块的 CPU 时间（用户态 + 内核态）
+    uint64_t minor_faults;      // 次缺页（页已在页缓存中）
+    uint64_t major_faults;      // 主缺页（需要读盘）
+
+    // 处理吞吐量，字节/秒
+    double throughput() const {
+        return busy_seconds > 0 ? bytes / busy_seconds : 0;
+    }
+};
+
+// 一次并行处理的统计，用于判断处理受 CPU、缺页还是磁盘限制：
+// cpu_seconds 接近 busy_seconds 时受 CPU 限制（内核态时间高、次缺页多时主要花在建立映射上），
+// stall_seconds 大且主缺页多时受磁盘限制
+struct PassStats {
+    static const int LATENCY_BUCKETS = 32;
+
+    uint64_t total_bytes;       // 需要处理的字节数
+    uint64_t bytes_done;
+    uint64_t chunks_done;
+    double elapsed_seconds;     // 从提交开始的墙钟时间
+    double busy_seconds;        // 各线程处理块的时间之和
+    double cpu_seconds;         // 各线程处理块的 CPU 时间之和
+    double stall_seconds;       // 处理块时不在 CPU 上的时间（等待缺页读盘等）
+    uint64_t minor_faults;
+    uint64_t major_faults;
+    uint64_t latency[LATENCY_BUCKETS];  // 块处理延迟直方图，第 i 格为 [2^i, 2^(i+1)) 微秒
+    std::vector<WorkerStats> workers;
+    bool finished;
+    bool cancelled;
+    bool timed_out;
+
+    // 整体吞吐量，字节/秒
+    double throughput() const {
+        return elapsed_seconds > 0 ? bytes_done / elapsed_seconds : 0;
+    }
+};
+
+// 处理被取消或超时，由 wait 抛出
+class PassCancelled : public std::runtime_error {
+public:
+    explicit PassCancelled(bool timed_out)
+        : std::runtime_error(timed_out ? "Pass timed out" : "Pass cancelled"), timed_out(timed_out) {}
+
+    bool timed_out;
+};
 
 class BigFileProcessor {
+public:
+    // 进度回调，在工作线程中调用，不应长时间阻塞
+    typedef std::function<void(const PassStats&)> ProgressCallback;
+
 private:
-    static const size_t CHUNK_SIZE = 64 * 1024 * 1024;  // 64MB chunks
-    static const size_t MAX_THREADS;                     // 最大线程数
+    static const size_t MAX_CHUNK = 64 * 1024 * 1024;  // 单次处理的最大块
+    static const size_t MIN_CHUNK = 1024 * 1024;       // 尾部拆分的最小块
+    static const size_t CHUNKS_PER_THREAD = 8;         // 每个线程的目标块数
+    static const size_t DEFAULT_STREAM_WINDOW = 1024 * 1024 * 1024;  // 流式模式默认预读窗口
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;    // 窗口映射的大页对齐
+
+    // 线程负责的字节范围，所有者从头部取块，其他线程从尾部窃取一半
+    struct alignas(64) WorkRange {
+        std::mutex lock;
+        size_t begin;
+        size_t end;
+    };
+
+    // 工作线程的统计计数，缓存行对齐避免伪共享，其他线程可以随时读取
+    struct alignas(64) WorkerCounters {
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> chunks{0};
+        std::atomic<uint64_t> busy_ns{0};
+        std::atomic<uint64_t> cpu_ns{0};
+        std::atomic<uint64_t> minor_faults{0};
+        std::atomic<uint64_t> major_faults{0};
+        std::atomic<uint64_t> latency[PassStats::LATENCY_BUCKETS];
+
+        WorkerCounters() {
+            for (auto& bucket : latency) {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    // 一次并行处理，调度状态只属于本次处理
+    struct Pass {
+        std::function<void(char*, size_t, size_t)> processor;  // (数据, 长度, 文件偏移)
+        std::unique_ptr<WorkRange[]> ranges;
+        size_t thread_count;    // 参与处理的线程数
+        size_t chunk;           // 单次处理的块大小
+        bool streaming;         // 流式模式：预读下一块，丢弃已处理的块
+        size_t window;          // 流式模式下所有线程预读量的上限
+        std::atomic<size_t> in_flight{0};  // 已预读尚未丢弃的字节数
+        size_t departed;        // 已离开本次处理的线程数，受 pool_mutex 保护
+        bool done;
+        std::exception_ptr error;  // 处理函数抛出的第一个异常
+
+        // 统计和控制
+        std::unique_ptr<WorkerCounters[]> counters;
+        int64_t start_ns;       // 提交时间
+        std::atomic<int64_t> end_ns{0};      // 完成时间，0 表示未完成
+        int64_t deadline_ns;    // 超时时间，0 表示不限制
+        std::atomic<bool> cancelled{false};
+        std::atomic<bool> timed_out{false};
+        ProgressCallback progress;
+        int64_t progress_interval_ns;
+        std::atomic<int64_t> last_report_ns{0};
+    };
 
     int fd;                     // 文件描述符
-    void* mapped_addr;          // 映射地址
+    void* mapped_addr;          // 整个文件的映射地址，窗口模式下为 nullptr
     size_t file_size;          // 文件大小
-    std::vector<std::thread> workers;  // 工作线程
-    std::mutex mtx;            // 互斥锁
-    std::atomic<size_t> processed_chunks{0};  // 已处理块数
+    bool read_only;             // 只读打开，所有映射只读
+    bool windowed;              // 窗口模式：每个线程只映射当前块
+    bool populate;              // 窗口映射时预先建立页表
+    bool huge_pages;            // 窗口按大页对齐并请求透明大页
+    std::vector<std::thread> workers;  // 常驻工作线程，首次提交时创建
+    std::vector<int> cpus;      // 允许运行的 CPU，工作线程依次绑定
+    std::vector<int> cpu_nodes; // 对应 CPU 所在的 NUMA 节点
+    bool pin_threads;           // 是否绑定 CPU
+    bool streaming;             // 新提交的处理是否使用流式模式
+    size_t stream_window;       // 流式模式的预读窗口
+    ProgressCallback progress;  // 新提交的处理使用的进度回调
+    double progress_interval;   // 进度回调的最小间隔，秒
+    double timeout;             // 新提交的处理的超时时间，0 表示不限制
+
+    std::mutex pool_mutex;      // 保护以下提交队列状态
+    std::condition_variable pool_cv;
+    std::deque<std::shared_ptr<Pass>> passes;  // 未完成的处理，按提交顺序执行
+    uint64_t first_pass;        // passes 队首的序号
+    uint64_t next_pass;         // 下一个提交的序号
+    bool stopping;
     
 public:
-    // 构造函数
-    BigFileProcessor(const char* filename, bool create = false) 
-        : fd(-1), mapped_addr(nullptr), file_size(0) {
+    // 异步处理的句柄
+    typedef std::shared_ptr<Pass> PassHandle;
+
+    // 构造函数，read_only 时只读打开，只读的处理不需要写权限
+    BigFileProcessor(const char* filename, bool create = false, bool read_only = false) 
+        : fd(-1), mapped_addr(nullptr), file_size(0), read_only(read_only && !create),
+          windowed(false), populate(false), huge_pages(false), pin_threads(true),
+          streaming(false), stream_window(DEFAULT_STREAM_WINDOW),
+          progress_interval(1.0), timeout(0),
+          first_pass(0), next_pass(0), stopping(false) {
+        detect_topology();
         
         // 打开或创建文件
         fd = open(filename, 
-                 create ? (O_RDWR | O_CREAT) : O_RDWR, 
+                 create ? (O_RDWR | O_CREAT) : (this->read_only ? O_RDONLY : O_RDWR), 
                  0666);
         
         if (fd == -1) {
@@ -46,16 +530,7 @@ public:
             file_size = sb.st_size;
 
             // 建立内存映射
-            mapped_addr = mmap(NULL, file_size, 
-                             PROT_READ | PROT_WRITE,
-                             MAP_SHARED, fd, 0);
-                             
-            if (mapped_addr == MAP_FAILED) {
-                throw std::runtime_error("Failed to map file");
-            }
-
-            // 设置内存访问模式
-            madvise(mapped_addr, file_size, MADV_RANDOM);
+            map_file();
         } catch (...) {
             if (fd != -1) {
                 close(fd);
@@ -66,76 +541,889 @@ public:
 
     // 析构函数
     ~BigFileProcessor() {
-        if (mapped_addr != MAP_FAILED && mapped_addr != nullptr) {
-            munmap(mapped_addr, file_size);
-        }
+        // 先等待已提交的处理完成，再解除映射
+        stop_pool();
+        unmap_file();
         if (fd != -1) {
             close(fd);
         }
     }
 
-    // 并行处理文件
+    // 线程数，默认等于允许运行的 CPU 数
+    size_t thread_count() const {
+        return cpus.size();
+    }
+
+    // 限制线程数，0 表示使用全部 CPU。已提交的处理会先完成
+    void set_thread_count(size_t count) {
+        stop_pool();
+        detect_topology();
+        if (count > 0 && count < cpus.size()) {
+            cpus.resize(count);
+            cpu_nodes.resize(count);
+        }
+    }
+
+    // 是否把工作线程绑定到 CPU（默认绑定）
+    void set_pin_threads(bool pin) {
+        stop_pool();
+        pin_threads = pin;
+    }
+
+    // 窗口模式：不映射整个文件，每个线程只映射正在处理的块，处理完立即解除映射，
+    // 内存和页表开销与文件大小无关，也不受地址空间限制。
+    // populate 时映射窗口使用 MAP_POPULATE；huge_pages 时窗口按 2MB 对齐并请求透明大页。
+    // 窗口模式下跨块的记录（process_records 等）以副本交给回调，修改不会写回文件
+    void set_windowed(bool enable, bool populate = false, bool huge_pages = false) {
+        stop_pool();
+        this->populate = populate;
+        this->huge_pages = huge_pages;
+        if (enable != windowed) {
+            unmap_file();
+            windowed = enable;
+            map_file();
+        }
+    }
+
+    // 流式模式，用于远大于内存的文件：每个线程处理当前块时预读下一块，
+    // 处理完的块解除映射、写回并从页缓存中丢弃，不会挤出其他数据。
+    // window 限制所有线程已预读尚未丢弃的总字节数，块大小也随之缩小。
+    // 只影响之后提交的处理
+    void set_streaming(bool enable, size_t window = DEFAULT_STREAM_WINDOW) {
+        streaming = enable;
+        stream_window = std::max(window, MIN_CHUNK);
+    }
+
+    // 设置之后提交的处理的进度回调，最多每 interval 秒调用一次，处理结束时再调用一次
+    void set_progress(ProgressCallback callback, double interval = 1.0) {
+        progress = callback;
+        progress_interval = interval;
+    }
+
+    // 设置之后提交的处理的超时时间（秒），0 表示不限制。
+    // 超时后不再开始新的块，正在处理的块会完成
+    void set_timeout(double seconds) {
+        timeout = seconds;
+    }
+
+    // 并行处理文件，等待处理完成并返回统计。处理函数抛出的异常在这里重新抛出
     template<typename Func>
-    void process_parallel(Func processor) {
-        size_t chunk_count = (file_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
-        size_t thread_count = std::min(
-            MAX_THREADS, 
-            static_cast<size_t>((chunk_count + 1) / 2)
-        );
+    PassStats process_parallel(Func processor) {
+        return wait(submit(processor));
+    }
+
+    // 异步提交一次并行处理，立即返回。
+    // 多次提交按顺序执行，前一次全部完成后才开始下一次，处理函数可以依赖前一次的结果。
+    // 文件按线程数连续划分，每个线程先处理自己的范围（绑定 CPU 后首次访问的页位于本地节点，
+    // 多次处理时同一范围仍由同一线程处理），空闲线程优先从同一 NUMA 节点的线程窃取剩余范围的后一半。
+    template<typename Func>
+    PassHandle submit(Func processor) {
+        return submit_chunks([processor](char* data, size_t size, size_t) mutable {
+            processor(data, size);
+        });
+    }
 
-        // 创建工作线程
-        for (size_t i = 0; i < thread_count; ++i) {
-            workers.emplace_back(&BigFileProcessor::worker_thread<Func>, 
-                               this, processor, chunk_count);
+    // 等待提交的处理完成并返回统计，被取消或超时时抛出 PassCancelled
+    PassStats wait(const PassHandle& pass) {
+        {
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            pool_cv.wait(lock, [&pass] { return pass->done; });
+            if (pass->error) {
+                std::rethrow_exception(pass->error);
+            }
         }
+        if (pass->cancelled) {
+            throw PassCancelled(pass->timed_out);
+        }
+        return stats(pass);
+    }
 
-        // 等待所有线程完成
-        for (auto& worker : workers) {
-            worker.join();
+    // 请求取消处理：不再开始新的块，正在处理的块会完成
+    void cancel(const PassHandle& pass) {
+        pass->cancelled = true;
+    }
+
+    // 处理的当前统计，处理进行中也可以调用
+    PassStats stats(const PassHandle& pass) {
+        return snapshot(*pass);
+    }
+
+    // 按分隔符并行处理记录，callback(record, length) 在多个线程中并发调用，收到的记录不含分隔符。
+    // 块边界不移动：每块处理起点落在块内的记录，块首不完整的记录留给前一块，
+    // 块尾的记录越过块边界读到下一个分隔符为止
+    template<typename Func>
+    void process_records(Func callback, char delimiter = '\n') {
+        wait(submit_chunks([=](char* data, size_t size, size_t offset) {
+            char* record = data;
+            char* stop = data + size;
+
+            // 跳过属于前一块的记录
+            if (offset > 0 && byte_at(offset - 1) != delimiter) {
+                const char* found = ChunkKernels::find_byte(data, size, delimiter);
+                if (!found) {
+                    return;  // 整块都在前一块开始的记录中
+                }
+                record = const_cast<char*>(found) + 1;
+            }
+
+            ChunkKernels::for_each_delimiter(record, stop - record, delimiter, [&](const char* found) {
+                callback(record, static_cast<size_t>(found - record));
+                record = const_cast<char*>(found) + 1;
+                return true;
+            });
+            if (record == stop) {
+                return;
+            }
+
+            // 最后一条记录延伸到块尾之后的第一个分隔符
+            size_t end = offset + size;
+            if (!windowed) {
+                char* base = static_cast<char*>(mapped_addr);
+                const char* last = ChunkKernels::find_byte(base + end, file_size - end, delimiter);
+                callback(record, static_cast<size_t>((last ? last : base + file_size) - record));
+            } else {
+                std::string buffer(record, stop);
+                read_until(end, delimiter, buffer);
+                callback(&buffer[0], buffer.size());
+            }
+        }));
+    }
+
+    // 按固定长度并行处理记录，文件末尾不足一条的部分作为最后一条较短的记录
+    template<typename Func>
+    void process_fixed_records(size_t record_size, Func callback) {
+        if (record_size == 0) {
+            throw std::invalid_argument("Record size must be positive");
         }
-        workers.clear();
+        wait(submit_chunks([=](char* data, size_t size, size_t offset) {
+            // 处理起点落在块内的记录
+            size_t first = (offset + record_size - 1) / record_size * record_size;
+            for (size_t start = first; start < offset + size; start += record_size) {
+                size_t length = std::min(record_size, file_size - start);
+                if (start + length <= offset + size || !windowed) {
+                    callback(data + (start - offset), length);
+                } else {
+                    // 窗口模式下越过块尾的记录读取副本
+                    std::string buffer(length, '\0');
+                    read_at(start, &buffer[0], length);
+                    callback(&buffer[0], length);
+                }
+            }
+        }));
+    }
+
+    // 并行复制变换到输出文件：transform(input, output, size) 把输入块变换到输出的相同位置，
+    // 在多个线程中并发调用。原文件不变，输出与输入等长，块顺序与输入一致。
+    // 输出文件先用 fallocate 预分配；默认逐块映射输出写入，direct 时用对齐缓冲区以 O_DIRECT 写入
+    // （文件系统不支持时退回普通写入）。每块写完立即开始写回，多个线程的写回并行进行，
+    // 流式模式下写回完成后从页缓存丢弃输出块
+    template<typename Func>
+    PassStats transform_to(const char* output, Func transform, bool direct = false) {
+        int out = open(output, O_RDWR | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0), 0666);
+        if (out == -1 && direct) {
+            direct = false;
+            out = open(output, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        }
+        if (out == -1) {
+            throw std::runtime_error("Failed to create output file");
+        }
+
+        // 每个线程复用一个对齐缓冲区
+        struct alignas(64) Buffer {
+            char* data = nullptr;
+            size_t size = 0;
+            ~Buffer() { free(data); }
+        };
+        std::unique_ptr<Buffer[]> buffers(new Buffer[std::max<size_t>(cpus.size(), 1)]);
+        bool drop = streaming;
+
+        PassStats stats;
+        try {
+            allocate_file(out, file_size);
+            stats = wait(submit_chunks([&, out, direct, drop](char* data, size_t size, size_t offset) {
+                if (direct) {
+                    // O_DIRECT 要求长度按页对齐，最后一块补零后写入，结束时截断
+                    Buffer& buffer = buffers[current_worker()];
+                    size_t length = align_up(size);
+                    if (buffer.size < length) {
+                        free(buffer.data);
+                        buffer.data = nullptr;
+                        buffer.size = 0;
+                        if (posix_memalign(reinterpret_cast<void**>(&buffer.data), 4096, length) != 0) {
+                            throw std::runtime_error("Failed to allocate buffer");
+                        }
+                        buffer.size = length;
+                    }
+                    transform(static_cast<const char*>(data), buffer.data, size);
+                    memset(buffer.data + size, 0, length - size);
+                    write_at(out, offset, buffer.data, length);
+                } else {
+                    Window window(*this, out, PROT_READ | PROT_WRITE, offset, size);
+                    transform(static_cast<const char*>(data), window.data, size);
+                }
+
+                if (drop) {
+                    sync_file_range(out, offset, size,
+                                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+                    posix_fadvise(out, offset, size, POSIX_FADV_DONTNEED);
+                } else {
+                    sync_file_range(out, offset, size, SYNC_FILE_RANGE_WRITE);
+                }
+            }));
+
+            if (direct && ftruncate(out, file_size) == -1) {
+                throw std::runtime_error("Failed to set file size");
+            }
+            if (fdatasync(out) == -1) {
+                throw std::runtime_error("Failed to sync output file");
+            }
+        } catch (...) {
+            close(out);
+            throw;
+        }
+        close(out);
+        return stats;
+    }
+
+    // 并行映射归约：mapper(data, size) 把每一块映射为 T，reducer(a, b) 合并两个结果。
+    // 每个线程在缓存行对齐的槽位中累加自己处理的连续块，最后按文件偏移顺序归约，
+    // 结果为 init 与各块结果按文件顺序依次归约的值。reducer 只需满足结合律，不要求交换律
+    template<typename T, typename Mapper, typename Reducer>
+    T map_reduce(Mapper mapper, Reducer reducer, T init) {
+        // 每个槽位保存若干段 (起始偏移, 部分结果)，窃取到不相邻的范围时开始新的一段
+        struct alignas(64) Partial {
+            std::vector<std::pair<size_t, T>> segments;
+            size_t next_offset = 0;
+        };
+        std::unique_ptr<Partial[]> partials(new Partial[std::max<size_t>(cpus.size(), 1)]);
+
+        wait(submit_chunks([&](char* data, size_t size, size_t offset) {
+            Partial& partial = partials[current_worker()];
+            T value = mapper(data, size);
+            if (!partial.segments.empty() && partial.next_offset == offset) {
+                T& last = partial.segments.back().second;
+                last = reducer(std::move(last), std::move(value));
+            } else {
+                partial.segments.emplace_back(offset, std::move(value));
+            }
+            partial.next_offset = offset + size;
+        }));
+
+        // 按偏移顺序归约
+        std::vector<std::pair<size_t, T>*> ordered;
+        for (size_t i = 0; i < std::max<size_t>(cpus.size(), 1); ++i) {
+            for (auto& segment : partials[i].segments) {
+                ordered.push_back(&segment);
+            }
+        }
+        std::sort(ordered.begin(), ordered.end(),
+                  [](const std::pair<size_t, T>* a, const std::pair<size_t, T>* b) {
+                      return a->first < b->first;
+                  });
+        T result = std::move(init);
+        for (auto* segment : ordered) {
+            result = reducer(std::move(result), std::move(segment->second));
+        }
+        return result;
+    }
+
+    // 检查提交的处理是否已完成，不等待
+    bool finished(const PassHandle& pass) {
+        std::lock_guard<std::mutex> guard(pool_mutex);
+        return pass->done;
     }
 
     // 创建大文件
-    static void create_big_file(const char* filename, size_t size) {
+    // preallocate 时用 fallocate 分配磁盘空间，之后的写入不需要再分配块，否则创建稀疏文件
+    static void create_big_file(const char* filename, size_t size, bool preallocate = false) {
         int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
         if (fd == -1) {
             throw std::runtime_error("Failed to create file");
         }
 
-        // 设置文件大小
-        if (ftruncate(fd, size) == -1) {
+        try {
+            if (preallocate) {
+                allocate_file(fd, size);
+            } else if (ftruncate(fd, size) == -1) {
+                // 设置文件大小
+                throw std::runtime_error("Failed to set file size");
+            }
+        } catch (...) {
             close(fd);
-            throw std::runtime_error("Failed to set file size");
+            throw;
         }
 
         close(fd);
     }
 
 private:
-    // 工作线程函数
-    template<typename Func>
-    void worker_thread(Func processor, size_t chunk_count) {
-        while (true) {
-            // 获取下一个要处理的块
-            size_t current_chunk = processed_chunks++;
-            if (current_chunk >= chunk_count) {
+    // 一个块的临时映射，析构时解除映射
+    struct Window {
+        void* addr;
+        size_t length;
+        char* data;   // 块的起始地址
+
+        // 映射文件 file 中 [start, start + size) 的范围，映射选项取自 owner
+        Window(const BigFileProcessor& owner, int file, int prot, size_t start, size_t size) {
+            // 文件偏移需要按页对齐，大页还要求虚拟地址和文件偏移按 2MB 对齐
+            size_t align = owner.huge_pages ? HUGE_PAGE_SIZE : 4096;
+            size_t map_offset = start & ~(align - 1);
+            length = start + size - map_offset;
+            int flags = MAP_SHARED | (owner.populate ? MAP_POPULATE : 0);
+
+            if (owner.huge_pages) {
+                // 先保留多出一个大页的地址空间，在其中找到对齐的位置
+                size_t reserved = length + HUGE_PAGE_SIZE;
+                char* base = static_cast<char*>(mmap(NULL, reserved, PROT_NONE,
+                                                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+                if (base == MAP_FAILED) {
+                    throw std::runtime_error("Failed to reserve window");
+                }
+                char* aligned = reinterpret_cast<char*>(
+                    (reinterpret_cast<uintptr_t>(base) + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+                addr = mmap(aligned, length, prot, flags | MAP_FIXED, file, map_offset);
+                if (addr == MAP_FAILED) {
+                    munmap(base, reserved);
+                    throw std::runtime_error("Failed to map window");
+                }
+                // 释放对齐位置前后多余的保留空间
+                char* tail = aligned + align_up(length);
+                if (aligned > base) {
+                    munmap(base, aligned - base);
+                }
+                if (tail < base + reserved) {
+                    munmap(tail, base + reserved - tail);
+                }
+                madvise(addr, length, MADV_HUGEPAGE);
+            } else {
+                addr = mmap(NULL, length, prot, flags, file, map_offset);
+                if (addr == MAP_FAILED) {
+                    throw std::runtime_error("Failed to map window");
+                }
+            }
+            madvise(addr, length, MADV_SEQUENTIAL);
+            data = static_cast<char*>(addr) + (start - map_offset);
+        }
+
+        ~Window() {
+            munmap(addr, length);
+        }
+    };
+
+    // 为文件分配 size 字节的磁盘空间，文件系统不支持时退回稀疏文件
+    static void allocate_file(int file, size_t size) {
+        if (size == 0) {
+            return;
+        }
+        if (fallocate(file, 0, 0, size) == 0) {
+            return;
+        }
+        if (errno != EOPNOTSUPP && errno != ENOSYS) {
+            throw std::runtime_error("Failed to allocate file");
+        }
+        if (ftruncate(file, size) == -1) {
+            throw std::runtime_error("Failed to set file size");
+        }
+    }
+
+    static void write_at(int file, size_t offset, const char* buffer, size_t size) {
+        while (size > 0) {
+            ssize_t n = pwrite(file, buffer, size, offset);
+            if (n <= 0) {
+                throw std::runtime_error("Failed to write file");
+            }
+            buffer += n;
+            offset += n;
+            size -= n;
+        }
+    }
+
+    // 映射整个文件，窗口模式和空文件不映射
+    void map_file() {
+        if (windowed || file_size == 0) {
+            return;
+        }
+        mapped_addr = mmap(NULL, file_size, 
+                         read_only ? PROT_READ : PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+                         
+        if (mapped_addr == MAP_FAILED) {
+            mapped_addr = nullptr;
+            throw std::runtime_error("Failed to map file");
+        }
+
+        // 设置内存访问模式，各线程在自己的范围内顺序处理
+        madvise(mapped_addr, file_size, MADV_SEQUENTIAL);
+    }
+
+    void unmap_file() {
+        if (mapped_addr != nullptr) {
+            munmap(mapped_addr, file_size);
+            mapped_addr = nullptr;
+        }
+    }
+
+    // 读取文件中的一个字节
+    char byte_at(size_t offset) {
+        if (!windowed) {
+            return static_cast<char*>(mapped_addr)[offset];
+        }
+        char value = 0;
+        read_at(offset, &value, 1);
+        return value;
+    }
+
+    void read_at(size_t offset, char* buffer, size_t size) {
+        while (size > 0) {
+            ssize_t n = pread(fd, buffer, size, offset);
+            if (n <= 0) {
+                throw std::runtime_error("Failed to read file");
+            }
+            buffer += n;
+            offset += n;
+            size -= n;
+        }
+    }
+
+    // 从 offset 开始读到分隔符（不含）或文件末尾，追加到 buffer
+    void read_until(size_t offset, char delimiter, std::string& buffer) {
+        char block[64 * 1024];
+        while (offset < file_size) {
+            size_t n = std::min(sizeof(block), file_size - offset);
+            read_at(offset, block, n);
+            const char* found = ChunkKernels::find_byte(block, n, delimiter);
+            if (found) {
+                buffer.append(block, found - block);
+                return;
+            }
+            buffer.append(block, n);
+            offset += n;
+        }
+    }
+
+    // 按页大小向上对齐，块边界对齐后向量化处理函数没有跨页的尾部
+    static size_t align_up(size_t size) {
+        const size_t PAGE = 4096;
+        return (size + PAGE - 1) & ~(PAGE - 1);
+    }
+
+    // 读取允许运行的 CPU 和所在的 NUMA 节点，没有 NUMA 信息时视为单节点
+    void detect_topology() {
+        cpus.clear();
+        cpu_nodes.clear();
+
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+        if (cpus.empty()) {
+            size_t count = std::max(1u, std::thread::hardware_concurrency());
+            for (size_t cpu = 0; cpu < count; ++cpu) {
+                cpus.push_back(static_cast<int>(cpu));
+            }
+        }
+
+        // 同一节点的 CPU 排在一起，相邻的文件范围由同一节点处理
+        std::vector<std::pair<int, int>> order;
+        for (int cpu : cpus) {
+            order.push_back({cpu_node(cpu), cpu});
+        }
+        std::sort(order.begin(), order.end());
+        for (size_t i = 0; i < order.size(); ++i) {
+            cpu_nodes.push_back(order[i].first);
+            cpus[i] = order[i].second;
+        }
+    }
+
+    // 查找 CPU 所在的 NUMA 节点
+    static int cpu_node(int cpu) {
+        for (int node = 0; node < 1024; ++node) {
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+            if (access(path, F_OK) == 0) {
+                return node;
+            }
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", node);
+            if (access(path, F_OK) != 0) {
                 break;
             }
+        }
+        return 0;
+    }
+
+    // 从 victim 的范围尾部窃取一半，成功时放入 self 的范围
+    bool steal(WorkRange& self, WorkRange& victim) {
+        size_t begin, end;
+        {
+            std::lock_guard<std::mutex> guard(victim.lock);
+            size_t remaining = victim.end - victim.begin;
+            if (remaining < 2 * MIN_CHUNK) {
+                return false;  // 剩余太少，留给所有者处理
+            }
+            begin = align_up(victim.begin + remaining / 2);
+            end = victim.end;
+            victim.end = begin;
+        }
+        std::lock_guard<std::mutex> guard(self.lock);
+        self.begin = begin;
+        self.end = end;
+        return true;
+    }
 
-            // 计算块的范围
-            size_t start = current_chunk * CHUNK_SIZE;
-            size_t end = std::min(start + CHUNK_SIZE, file_size);
-            
-            // 处理数据块
+    // 提交一次处理，处理函数额外收到块的文件偏移
+    PassHandle submit_chunks(std::function<void(char*, size_t, size_t)> processor) {
+        std::shared_ptr<Pass> pass = std::make_shared<Pass>();
+        pass->processor = std::move(processor);
+        pass->departed = 0;
+        pass->done = false;
+        pass->start_ns = now_ns();
+        pass->deadline_ns = timeout > 0 ? pass->start_ns + static_cast<int64_t>(timeout * 1e9) : 0;
+        pass->progress = progress;
+        pass->progress_interval_ns = static_cast<int64_t>(progress_interval * 1e9);
+        pass->last_report_ns = pass->start_ns;
+
+        size_t thread_count = std::min(cpus.size(), (file_size + MIN_CHUNK - 1) / MIN_CHUNK);
+        pass->thread_count = std::max<size_t>(thread_count, 1);
+
+        // 块大小随文件大小和线程数调整，每个线程至少分到若干块以便均衡
+        size_t chunk = file_size / (pass->thread_count * CHUNKS_PER_THREAD);
+        pass->chunk = std::min(MAX_CHUNK, std::max(MIN_CHUNK, align_up(chunk)));
+        pass->streaming = streaming;
+        pass->window = stream_window;
+        if (streaming) {
+            // 每个线程需要容纳当前块和预读的下一块
+            size_t limit = align_up(stream_window / (pass->thread_count * 2));
+            pass->chunk = std::max(MIN_CHUNK, std::min(pass->chunk, limit));
+        }
+
+        pass->ranges.reset(new WorkRange[pass->thread_count]);
+        pass->counters.reset(new WorkerCounters[pass->thread_count]);
+        for (size_t i = 0; i < pass->thread_count; ++i) {
+            WorkRange& range = pass->ranges[i];
+            range.begin = std::min(file_size, align_up(file_size / pass->thread_count * i));
+            range.end = i + 1 == pass->thread_count
+                ? file_size
+                : std::min(file_size, align_up(file_size / pass->thread_count * (i + 1)));
+        }
+
+        std::lock_guard<std::mutex> guard(pool_mutex);
+        if (workers.empty()) {
+            for (size_t i = 0; i < cpus.size(); ++i) {
+                workers.emplace_back(&BigFileProcessor::worker_thread, this, i);
+            }
+        }
+        passes.push_back(pass);
+        next_pass++;
+        pool_cv.notify_all();
+        return pass;
+    }
+
+    // 等待已提交的处理完成后退出工作线程
+    void stop_pool() {
+        {
+            std::lock_guard<std::mutex> guard(pool_mutex);
+            stopping = true;
+            pool_cv.notify_all();
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        stopping = false;
+    }
+
+    // 当前工作线程的序号
+    static size_t& current_worker() {
+        static thread_local size_t index = 0;
+        return index;
+    }
+
+    // 常驻工作线程，依次参与每一次提交的处理
+    void worker_thread(size_t index) {
+        current_worker() = index;
+        if (pin_threads) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[index], &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+
+        uint64_t sequence;  // 下一次要参与的处理
+        {
+            std::lock_guard<std::mutex> guard(pool_mutex);
+            sequence = first_pass;
+        }
+        while (true) {
+            std::shared_ptr<Pass> pass;
+            {
+                // 只有队首的处理可以执行
+                std::unique_lock<std::mutex> lock(pool_mutex);
+                pool_cv.wait(lock, [this, sequence] {
+                    return (sequence == first_pass && !passes.empty()) || (stopping && passes.empty());
+                });
+                if (passes.empty()) {
+                    break;
+                }
+                pass = passes.front();
+            }
+
+            if (index < pass->thread_count) {
+                try {
+                    run_pass(*pass, index);
+                } catch (...) {
+                    std::lock_guard<std::mutex> guard(pool_mutex);
+                    if (!pass->error) {
+                        pass->error = std::current_exception();
+                    }
+                    // 出错后放弃剩余的块
+                    for (size_t i = 0; i < pass->thread_count; ++i) {
+                        std::lock_guard<std::mutex> range_guard(pass->ranges[i].lock);
+                        pass->ranges[i].begin = pass->ranges[i].end;
+                    }
+                }
+            }
+
+            // 最后离开的线程结束本次处理
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            if (++pass->departed == workers.size()) {
+                // 最后一次进度回调在 wait 返回前完成
+                pass->end_ns = now_ns();
+                if (pass->progress) {
+                    lock.unlock();
+                    report_progress(*pass);
+                    lock.lock();
+                }
+                pass->done = true;
+                passes.pop_front();
+                first_pass++;
+                pool_cv.notify_all();
+            }
+            sequence++;
+        }
+    }
+
+    // 从范围头部取下一块的大小，接近尾部时块逐渐变小，方便其他线程分担
+    static size_t piece_size(const Pass& pass, const WorkRange& range) {
+        size_t remaining = range.end - range.begin;
+        size_t size = std::min(pass.chunk, std::max(MIN_CHUNK, align_up(remaining / 2)));
+        return std::min(size, remaining);
+    }
+
+    // 流式模式：在窗口允许时预读一块，返回占用的窗口字节数
+    size_t prefetch(Pass& pass, size_t start, size_t size) {
+        if (size == 0) {
+            return 0;
+        }
+        if (pass.in_flight.fetch_add(size) + size > pass.window) {
+            pass.in_flight.fetch_sub(size);
+            return 0;
+        }
+        if (windowed) {
+            posix_fadvise(fd, start, size, POSIX_FADV_WILLNEED);
+        } else {
+            madvise(static_cast<char*>(mapped_addr) + start, size, MADV_WILLNEED);
+        }
+        return size;
+    }
+
+    // 流式模式：丢弃处理完的块。先解除映射并开始写回脏页，
+    // 页缓存在写回完成后才能丢弃，所以延后一块再丢弃
+    void drop_behind(size_t start, size_t size) {
+        if (!windowed) {
+            // 窗口模式下块在处理后已解除映射
             char* chunk_start = static_cast<char*>(mapped_addr) + start;
-            processor(chunk_start, end - start);
+#ifdef MADV_COLD
+            madvise(chunk_start, size, MADV_COLD);
+#endif
+            madvise(chunk_start, size, MADV_DONTNEED);
+        }
+        sync_file_range(fd, start, size, SYNC_FILE_RANGE_WRITE);
+    }
+
+    void release_cache(size_t start, size_t size) {
+        if (size == 0) {
+            return;
+        }
+        sync_file_range(fd, start, size,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, start, size, POSIX_FADV_DONTNEED);
+    }
+
+    // 处理一块并记录统计，窗口模式下临时映射该块
+    void process_chunk(Pass& pass, size_t index, size_t start, size_t size) {
+        struct rusage before, after;
+        getrusage(RUSAGE_THREAD, &before);
+        int64_t begin_ns = now_ns();
+
+        if (!windowed) {
+            pass.processor(static_cast<char*>(mapped_addr) + start, size, start);
+        } else {
+            Window window(*this, fd, read_only ? PROT_READ : PROT_READ | PROT_WRITE, start, size);
+            pass.processor(window.data, size, start);
+        }
+
+        int64_t end_ns = now_ns();
+        getrusage(RUSAGE_THREAD, &after);
+
+        WorkerCounters& counters = pass.counters[index];
+        uint64_t busy = end_ns - begin_ns;
+        uint64_t cpu = cpu_ns(after) - cpu_ns(before);
+        counters.bytes.fetch_add(size, std::memory_order_relaxed);
+        counters.chunks.fetch_add(1, std::memory_order_relaxed);
+        counters.busy_ns.fetch_add(busy, std::memory_order_relaxed);
+        counters.cpu_ns.fetch_add(cpu, std::memory_order_relaxed);
+        counters.minor_faults.fetch_add(after.ru_minflt - before.ru_minflt, std::memory_order_relaxed);
+        counters.major_faults.fetch_add(after.ru_majflt - before.ru_majflt, std::memory_order_relaxed);
+
+        int bucket = 0;
+        for (uint64_t us = busy / 1000; us > 1 && bucket < PassStats::LATENCY_BUCKETS - 1; us >>= 1) {
+            bucket++;
+        }
+        counters.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+
+        // 间隔到期时由抢到的线程报告进度
+        if (pass.progress) {
+            int64_t last = pass.last_report_ns.load(std::memory_order_relaxed);
+            if (end_ns - last >= pass.progress_interval_ns &&
+                pass.last_report_ns.compare_exchange_strong(last, end_ns)) {
+                report_progress(pass);
+            }
+        }
+    }
+
+    // 检查取消和超时
+    static bool should_stop(Pass& pass) {
+        if (pass.cancelled.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        if (pass.deadline_ns && now_ns() >= pass.deadline_ns) {
+            pass.timed_out = true;
+            pass.cancelled = true;
+            return true;
+        }
+        return false;
+    }
+
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t cpu_ns(const struct rusage& usage) {
+        return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL +
+               (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+    }
+
+    // 汇总各线程的计数
+    PassStats snapshot(const Pass& pass) {
+        PassStats result = PassStats();
+        result.total_bytes = file_size;
+        int64_t end = pass.end_ns.load();
+        result.finished = end != 0;
+        result.elapsed_seconds = ((end ? end : now_ns()) - pass.start_ns) / 1e9;
+        result.cancelled = pass.cancelled;
+        result.timed_out = pass.timed_out;
+
+        for (size_t i = 0; i < pass.thread_count; ++i) {
+            const WorkerCounters& counters = pass.counters[i];
+            WorkerStats worker;
+            worker.bytes = counters.bytes.load(std::memory_order_relaxed);
+            worker.chunks = counters.chunks.load(std::memory_order_relaxed);
+            worker.busy_seconds = counters.busy_ns.load(std::memory_order_relaxed) / 1e9;
+            worker.cpu_seconds = counters.cpu_ns.load(std::memory_order_relaxed) / 1e9;
+            worker.minor_faults = counters.minor_faults.load(std::memory_order_relaxed);
+            worker.major_faults = counters.major_faults.load(std::memory_order_relaxed);
+            for (int b = 0; b < PassStats::LATENCY_BUCKETS; ++b) {
+                result.latency[b] += counters.latency[b].load(std::memory_order_relaxed);
+            }
+
+            result.bytes_done += worker.bytes;
+            result.chunks_done += worker.chunks;
+            result.busy_seconds += worker.busy_seconds;
+            result.cpu_seconds += worker.cpu_seconds;
+            result.minor_faults += worker.minor_faults;
+            result.major_faults += worker.major_faults;
+            result.workers.push_back(worker);
+        }
+        result.stall_seconds = std::max(0.0, result.busy_seconds - result.cpu_seconds);
+        return result;
+    }
+
+    void report_progress(const Pass& pass) {
+        try {
+            pass.progress(snapshot(pass));
+        } catch (...) {
+            // 进度回调的异常不影响处理
+        }
+    }
+
+    // 执行一次处理中属于 index 的部分
+    void run_pass(Pass& pass, size_t index) {
+        WorkRange& self = pass.ranges[index];
+        size_t held = 0;                        // 当前块占用的预读窗口
+        size_t behind_start = 0, behind_size = 0;  // 等待丢弃的上一块
+        while (!should_stop(pass)) {
+            size_t start, size, next_start, next_size;
+            {
+                std::lock_guard<std::mutex> guard(self.lock);
+                size = piece_size(pass, self);
+                start = self.begin;
+                self.begin += size;
+                next_start = self.begin;
+                next_size = piece_size(pass, self);
+            }
+
+            if (size > 0) {
+                // 处理数据块
+                if (!pass.streaming) {
+                    process_chunk(pass, index, start, size);
+                    continue;
+                }
+
+                size_t next_held = prefetch(pass, next_start, next_size);
+                process_chunk(pass, index, start, size);
+                drop_behind(start, size);
+                release_cache(behind_start, behind_size);
+                behind_start = start;
+                behind_size = size;
+                pass.in_flight.fetch_sub(held);
+                held = next_held;
+                continue;
+            }
+
+            // 自己的范围已处理完，先从同一节点窃取，再从其他节点窃取
+            bool stolen = false;
+            for (int round = 0; round < 2 && !stolen; ++round) {
+                for (size_t i = 1; i < pass.thread_count && !stolen; ++i) {
+                    size_t victim = (index + i) % pass.thread_count;
+                    bool same_node = cpu_nodes[victim] == cpu_nodes[index];
+                    if (same_node == (round == 0)) {
+                        stolen = steal(self, pass.ranges[victim]);
+                    }
+                }
+            }
+            if (!stolen) {
+                break;
+            }
+        }
+        if (pass.streaming) {
+            release_cache(behind_start, behind_size);
+            pass.in_flight.fetch_sub(held);
         }
     }
 };
 
-// 在类外定义静态成员变量
-const size_t BigFileProcessor::MAX_THREADS = 8;
+// 常量会经由 std::min/std::max 按引用使用，需要类外定义
+const size_t BigFileProcessor::MAX_CHUNK;
+const size_t BigFileProcessor::MIN_CHUNK;
+const size_t BigFileProcessor::CHUNKS_PER_THREAD;
+const size_t BigFileProcessor::DEFAULT_STREAM_WINDOW;
+const size_t BigFileProcessor::HUGE_PAGE_SIZE;
 
 int main() {
     try {
@@ -144,34 +1432,36 @@ int main() {
         
         // 创建测试文件
         printf("Creating test file...\n");
-        BigFileProcessor::create_big_file(filename, FILE_SIZE);
+        BigFileProcessor::create_big_file(filename, FILE_SIZE, true);
         
         // 打开文件进行处理
         BigFileProcessor processor(filename);
         
         // 示例1：计算文件中非零字节的数量
-        std::atomic<size_t> nonzero_count{0};
+        printf("Processing file (%s kernels)...\n", ChunkKernels::isa());
+        size_t nonzero_count = processor.map_reduce(
+            [](char* data, size_t size) { return ChunkKernels::count_nonzero(data, size); },
+            [](size_t a, size_t b) { return a + b; },
+            size_t(0));
         
-        printf("Processing file...\n");
-        processor.process_parallel([&nonzero_count](char* data, size_t size) {
-            size_t local_count = 0;
-            for (size_t i = 0; i < size; ++i) {
-                if (data[i] != 0) {
-                    local_count++;
-                }
-            }
-            nonzero_count += local_count;
-        });
-        
-        printf("Non-zero bytes: %zu\n", nonzero_count.load());
+        printf("Non-zero bytes: %zu\n", nonzero_count);
         
         // 示例2：将所有字节加1
         printf("Modifying file...\n");
-        processor.process_parallel([](char* data, size_t size) {
-            for (size_t i = 0; i < size; ++i) {
-                data[i]++;
-            }
+        PassStats stats = processor.process_parallel([](char* data, size_t size) {
+            ChunkKernels::add_bytes(data, size, 1);
+        });
+        printf("%.1f MB/s, cpu %.2fs, stalled %.2fs, %llu minor / %llu major faults\n",
+               stats.throughput() / (1024 * 1024), stats.cpu_seconds, stats.stall_seconds,
+               (unsigned long long)stats.minor_faults, (unsigned long long)stats.major_faults);
+        
+        // 示例3：原文件不变，把每个字节异或后写入新文件
+        printf("Transforming to new file...\n");
+        stats = processor.transform_to("bigfile.out", [](const char* input, char* output, size_t size) {
+            memcpy(output, input, size);
+            ChunkKernels::xor_bytes(output, size, 0x5a);
         });
+        printf("%.1f MB/s\n", stats.throughput() / (1024 * 1024));
         
         printf("File processing completed.\n");
         
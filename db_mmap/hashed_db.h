@@ -0,0 +1,478 @@
+#pragma once
+#include "optimized_db.h"
+#include <atomic>
+#include <stddef.h>
+#include <string>
+
+// 哈希桶，大小与缓存行一致，一次查找通常只访问一个缓存行
+struct alignas(64) HashBucket {
+    static const int SLOTS = 4;
+    uint32_t keys[SLOTS];      // 键值数组
+    uint32_t count;            // 当前键值数量
+    std::atomic<uint32_t> version;  // 桶链版本号，只在链首桶使用，奇数表示正在修改
+    uint64_t overflow;         // 溢出桶偏移，0 表示没有
+    uint64_t values[SLOTS];    // 数据指针
+};
+
+// 线性哈希元数据，位于哈希文件开头，桶按段分配，段表常驻缓存
+struct HashMeta {
+    static const uint32_t SEGMENT_BUCKETS = 1024;   // 每段桶数，同时是初始桶数
+    static const uint32_t MAX_SEGMENTS = 8192;
+    char magic[4];             // 魔数 "MMHT"
+    uint32_t version;          // 哈希文件版本号
+    uint32_t clean;            // 正常关闭标志，打开期间为 0
+    uint32_t next_key;         // 下一个可用的键值
+    uint32_t level;            // 当前轮次，本轮桶数为 SEGMENT_BUCKETS << level
+    uint32_t split;            // 下一个要分裂的桶
+    std::atomic<uint32_t> sequence;  // 分裂序号，奇数表示正在分裂
+    uint32_t reserved;
+    uint64_t entries;          // 键值总数
+    uint64_t free_overflow;    // 空闲溢出桶链表
+    uint64_t data_end;         // 关闭时数据文件的 data_start，用于检查两个文件是否一致
+    uint64_t table_end;        // 哈希文件中下一个可分配的位置
+    uint64_t segments[MAX_SEGMENTS];  // 各段在哈希文件中的偏移
+};
+
+class HashedDB : public OptimizedDB {
+private:
+    static const uint32_t HASH_VERSION = 2;    // 哈希表位于独立文件，查找不加锁
+    static const uint32_t MAX_LOAD = 3;        // 平均每桶键数超过该值时分裂
+    static const size_t TABLE_INITIAL_SIZE = 256 * 1024;
+
+    HashMeta* meta;
+    std::atomic<uint32_t> next_key;  // 下一个可用的键值
+    std::mutex write_mutex;          // 写者互斥，读者不加锁
+    std::mutex alloc_mutex;          // 保护数据文件尾部空间分配
+
+    // 段和溢出桶保存在独立的哈希文件（<数据文件名>.hash）中，不与记录交错，
+    // 数据文件只包含记录，哈希文件缺失或损坏时可以从记录重建
+    int table_fd;
+    char* table_addr;                // 哈希文件映射基地址，扩展时不变
+    std::atomic<size_t> table_size;  // 哈希文件映射大小
+    size_t table_reserved;           // 预留地址空间大小
+
+protected:
+    using OptimizedDB::addr;
+    using OptimizedDB::header;
+    using OptimizedDB::get_record;
+
+public:
+    HashedDB(const char* filename) : OptimizedDB(filename), meta(nullptr), next_key(1),
+        table_fd(-1), table_addr(nullptr), table_size(0), table_reserved(0) {
+        if (header->version != 1) {
+            throw "Unsupported database version";
+        }
+
+        bool is_new = open_table_file((std::string(filename) + ".hash").c_str());
+        meta = reinterpret_cast<HashMeta*>(table_addr);
+        if (!is_new && memcmp(meta->magic, "MMHT", 4) == 0 &&
+            meta->version == HASH_VERSION && meta->clean == 1 &&
+            meta->data_end == header->data_start) {
+            // 哈希表完整且与数据文件一致，直接使用
+            next_key = meta->next_key;
+        } else {
+            // 新哈希文件、上次未正常关闭或数据文件已变化，从记录重建
+            rebuild_table();
+        }
+        meta->clean = 0;
+        msync(table_addr, 4096, MS_SYNC);
+    }
+
+    ~HashedDB() override {
+        // 保存元数据并标记正常关闭
+        meta->next_key = next_key;
+        meta->data_end = header->data_start;
+        meta->clean = 1;
+
+        msync(table_addr, table_size, MS_SYNC);
+        munmap(table_addr, table_reserved);
+        close(table_fd);
+    }
+
+    // 重写写入方法，维护哈希索引
+    uint64_t write(const void* data, size_t size) override {
+        uint64_t pos;
+        uint32_t id;
+        {
+            // 键值与记录在同一把锁内分配，保证键值等于记录在文件中的序号，
+            // 重建时可以据此恢复
+            std::lock_guard<std::mutex> lock(alloc_mutex);
+            pos = OptimizedDB::write(data, size);
+            if (pos == 0) return 0;
+            id = next_key++;
+        }
+        std::lock_guard<std::mutex> lock(write_mutex);
+        insert(id, pos);
+        return pos;
+    }
+
+    // 批量写入，记录和哈希项各只加一次锁。
+    // 基类的批量写入绕过了 write，不会维护哈希索引
+    void batch_write(const std::vector<std::pair<const void*, size_t>>& records,
+                     std::vector<uint64_t>& positions) {
+        size_t first = positions.size();
+        uint32_t id;
+        {
+            std::lock_guard<std::mutex> lock(alloc_mutex);
+            id = next_key;
+            for (const auto& record : records) {
+                uint64_t pos = OptimizedDB::write(record.first, record.second);
+                positions.push_back(pos);
+                if (pos) next_key++;
+            }
+        }
+        std::lock_guard<std::mutex> lock(write_mutex);
+        for (size_t i = first; i < positions.size(); i++) {
+            if (positions[i]) insert(id++, positions[i]);
+        }
+    }
+
+    // 删除记录并移除哈希项。记录位置无法换算成键值，需要遍历所有桶链，
+    // 已知键值时应使用 remove_by_id
+    bool remove(uint64_t pos) override {
+        {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            uint32_t buckets = bucket_count();
+            for (uint32_t b = 0; b < buckets; b++) {
+                if (erase_in_chain(get_bucket(b), [pos](uint32_t, uint64_t value) {
+                        return value == pos;
+                    })) {
+                    break;
+                }
+            }
+        }
+        return OptimizedDB::remove(pos);
+    }
+
+    // 按键值删除记录
+    bool remove_by_id(uint32_t id) {
+        uint64_t pos;
+        {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            pos = erase_in_chain(get_bucket(bucket_index(id)), [id](uint32_t key, uint64_t) {
+                return key == id;
+            });
+        }
+        return pos != 0 && OptimizedDB::remove(pos);
+    }
+
+    // 使用哈希索引查找，直接从映射区复制记录，不经过页面缓存
+    bool read_by_id(uint32_t id, void* buffer, size_t* size) {
+        uint64_t pos = find(id);
+        if (pos == 0) return false;
+        return SimpleDB::read(pos, buffer, size);
+    }
+
+    // 查找记录位置，不存在返回 0。
+    // 读者不加锁：读取前后分裂序号和链首桶版本号都没有变化才算读到一致的桶链，
+    // 否则重试；读到的溢出桶偏移不合法时同样重试
+    uint64_t find(uint32_t key) {
+        for (int spins = 0;; spins++) {
+            if (spins > 64) std::this_thread::yield();
+            uint32_t sequence = meta->sequence.load(std::memory_order_acquire);
+            if (sequence & 1) continue;
+            uint32_t index = bucket_index(key);
+            if (index / HashMeta::SEGMENT_BUCKETS >= HashMeta::MAX_SEGMENTS ||
+                meta->segments[index / HashMeta::SEGMENT_BUCKETS] == 0) {
+                continue;
+            }
+            HashBucket* head = get_bucket(index);
+            uint32_t version = head->version.load(std::memory_order_acquire);
+            if (version & 1) continue;
+
+            uint64_t value = 0;
+            bool consistent = true;
+            HashBucket* bucket = head;
+            while (true) {
+                uint32_t count = std::min<uint32_t>(bucket->count, HashBucket::SLOTS);
+                for (uint32_t i = 0; i < count; i++) {
+                    if (bucket->keys[i] == key) {
+                        value = bucket->values[i];
+                        break;
+                    }
+                }
+                uint64_t next = bucket->overflow;
+                if (value || next == 0) break;
+                // 链首版本号变化说明链正在被修改，避免沿着改写中的指针走下去
+                if (!valid_overflow(next) ||
+                    head->version.load(std::memory_order_acquire) != version) {
+                    consistent = false;
+                    break;
+                }
+                bucket = get_overflow(next);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (consistent && head->version.load(std::memory_order_relaxed) == version &&
+                meta->sequence.load(std::memory_order_relaxed) == sequence) {
+                return value;
+            }
+        }
+    }
+
+private:
+    // 打开或创建哈希文件，返回是否为新建
+    bool open_table_file(const char* filename) {
+        table_fd = open(filename, O_RDWR | O_CREAT, 0644);
+        if (table_fd == -1) {
+            throw "Cannot open hash file";
+        }
+
+        struct stat st;
+        if (fstat(table_fd, &st) == -1) {
+            close(table_fd);
+            throw "Cannot get hash file size";
+        }
+        bool is_new = (size_t)st.st_size < sizeof(HashMeta);
+        size_t size = is_new ? TABLE_INITIAL_SIZE : st.st_size;
+        if (is_new && ftruncate(table_fd, size) == -1) {
+            close(table_fd);
+            throw "Cannot set hash file size";
+        }
+
+        // 与数据文件相同，预留地址空间后原地扩展，读者持有的指针始终有效
+        table_reserved = size > RESERVED_SIZE ? size : RESERVED_SIZE;
+        void* base = mmap(NULL, table_reserved, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED ||
+            mmap(base, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, table_fd, 0) == MAP_FAILED) {
+            if (base != MAP_FAILED) munmap(base, table_reserved);
+            close(table_fd);
+            throw "Cannot map hash file";
+        }
+        table_addr = static_cast<char*>(base);
+        table_size = size;
+        return is_new;
+    }
+
+    // 扩展哈希文件，只映射新增部分
+    bool extend_table(size_t new_size) {
+        size_t size = table_size.load(std::memory_order_relaxed);
+        if (new_size > table_reserved || ftruncate(table_fd, new_size) == -1) {
+            return false;
+        }
+        if (mmap(table_addr + size, new_size - size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, table_fd, size) == MAP_FAILED) {
+            return false;
+        }
+        table_size.store(new_size, std::memory_order_release);
+        return true;
+    }
+
+    // 从记录重建哈希表，键值即记录序号，已删除记录占用键值但不进入哈希表
+    void rebuild_table() {
+        memset(static_cast<void*>(meta), 0, sizeof(HashMeta));
+        memcpy(meta->magic, "MMHT", 4);
+        meta->version = HASH_VERSION;
+        meta->table_end = (sizeof(HashMeta) + 4095) & ~(uint64_t)4095;
+        meta->segments[0] = allocate_segment();
+
+        uint32_t id = 0;
+        uint64_t pos = sizeof(DBHeader);
+        while (pos + sizeof(RecordHeader) <= header->data_start) {
+            RecordHeader* rec = get_record(pos);
+            if (rec->next <= pos) break;
+            id++;
+            if (!(rec->flags & 1)) insert(id, pos);
+            pos = rec->next;
+        }
+        next_key = id + 1;
+    }
+
+    // 从哈希文件尾部分配对齐的空间，新空间清零。只在持有写者锁或打开期间调用
+    uint64_t allocate(size_t size, size_t align) {
+        uint64_t offset = (meta->table_end + align - 1) & ~(uint64_t)(align - 1);
+        size_t current = table_size.load(std::memory_order_relaxed);
+        if (offset + size > current) {
+            size_t new_size = current * 2;
+            while (new_size < offset + size) {
+                new_size *= 2;
+            }
+            if (!extend_table(new_size)) {
+                throw "Cannot extend hash table";
+            }
+        }
+        meta->table_end = offset + size;
+        memset(table_addr + offset, 0, size);
+        return offset;
+    }
+
+    uint64_t allocate_segment() {
+        return allocate(sizeof(HashBucket) * HashMeta::SEGMENT_BUCKETS, 4096);
+    }
+
+    // 分配溢出桶，优先复用空闲链表
+    uint64_t allocate_overflow() {
+        if (meta->free_overflow) {
+            uint64_t offset = meta->free_overflow;
+            HashBucket* bucket = get_overflow(offset);
+            meta->free_overflow = bucket->overflow;
+            memset(static_cast<void*>(bucket), 0, sizeof(HashBucket));
+            return offset;
+        }
+        return allocate(sizeof(HashBucket), 64);
+    }
+
+    // 读者读到的溢出桶偏移是否落在已映射的范围内
+    bool valid_overflow(uint64_t offset) {
+        return offset % sizeof(HashBucket) == 0 &&
+               offset + sizeof(HashBucket) <= table_size.load(std::memory_order_acquire);
+    }
+
+    // 整数哈希（murmur3 finalizer），保证连续键均匀分布
+    static uint32_t hash(uint32_t key) {
+        key ^= key >> 16;
+        key *= 0x85ebca6b;
+        key ^= key >> 13;
+        key *= 0xc2b2ae35;
+        key ^= key >> 16;
+        return key;
+    }
+
+    // 线性哈希寻址：已分裂的桶使用下一轮的模数
+    uint32_t bucket_index(uint32_t key) {
+        uint32_t h = hash(key);
+        uint32_t mask = (HashMeta::SEGMENT_BUCKETS << meta->level) - 1;
+        uint32_t index = h & mask;
+        if (index < meta->split) {
+            index = h & (mask << 1 | 1);
+        }
+        return index;
+    }
+
+    uint32_t bucket_count() {
+        return (HashMeta::SEGMENT_BUCKETS << meta->level) + meta->split;
+    }
+
+    HashBucket* get_bucket(uint32_t index) {
+        uint64_t segment = meta->segments[index / HashMeta::SEGMENT_BUCKETS];
+        return reinterpret_cast<HashBucket*>(table_addr + segment) +
+               index % HashMeta::SEGMENT_BUCKETS;
+    }
+
+    HashBucket* get_overflow(uint64_t offset) {
+        return reinterpret_cast<HashBucket*>(table_addr + offset);
+    }
+
+    // 开始修改桶链：版本号变为奇数必须先于链上的写入被读者看到
+    void begin_modify(HashBucket* head) {
+        head->version.store(head->version.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void end_modify(HashBucket* head) {
+        head->version.store(head->version.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_release);
+    }
+
+    // 追加到桶链末尾
+    void append(HashBucket* bucket, uint32_t key, uint64_t value) {
+        while (bucket->count == HashBucket::SLOTS) {
+            if (bucket->overflow == 0) {
+                uint64_t offset = allocate_overflow();
+                bucket->overflow = offset;
+            }
+            bucket = get_overflow(bucket->overflow);
+        }
+        bucket->keys[bucket->count] = key;
+        bucket->values[bucket->count] = value;
+        bucket->count++;
+    }
+
+    // 插入键值，负载过高时分裂一个桶
+    void insert(uint32_t key, uint64_t value) {
+        HashBucket* head = get_bucket(bucket_index(key));
+        begin_modify(head);
+        append(head, key, value);
+        end_modify(head);
+        meta->entries++;
+        if (meta->entries > (uint64_t)bucket_count() * MAX_LOAD) {
+            split_bucket();
+        }
+    }
+
+    // 删除桶链中第一个满足条件的键值，返回其记录位置，没有找到返回 0。
+    // 空位用同一个桶的最后一个键值填补，溢出桶空了就从链上摘下归还
+    template <typename Match>
+    uint64_t erase_in_chain(HashBucket* head, Match match) {
+        HashBucket* prev = nullptr;
+        HashBucket* bucket = head;
+        while (true) {
+            for (uint32_t i = 0; i < bucket->count; i++) {
+                if (!match(bucket->keys[i], bucket->values[i])) continue;
+                uint64_t value = bucket->values[i];
+                begin_modify(head);
+                bucket->count--;
+                bucket->keys[i] = bucket->keys[bucket->count];
+                bucket->values[i] = bucket->values[bucket->count];
+                if (bucket->count == 0 && prev) {
+                    uint64_t offset = prev->overflow;
+                    prev->overflow = bucket->overflow;
+                    bucket->overflow = meta->free_overflow;
+                    meta->free_overflow = offset;
+                }
+                end_modify(head);
+                meta->entries--;
+                return value;
+            }
+            if (bucket->overflow == 0) return 0;
+            prev = bucket;
+            bucket = get_overflow(bucket->overflow);
+        }
+    }
+
+    // 分裂 split 指向的桶，每次只搬迁一个桶，不会整体重哈希。
+    // 分裂期间分裂序号为奇数，读者等待分裂完成后重试
+    void split_bucket() {
+        uint32_t old_index = meta->split;
+        uint32_t new_index = bucket_count();
+        if (new_index / HashMeta::SEGMENT_BUCKETS >= HashMeta::MAX_SEGMENTS) {
+            return;  // 段表已满，只能使用溢出桶
+        }
+        if (new_index % HashMeta::SEGMENT_BUCKETS == 0) {
+            meta->segments[new_index / HashMeta::SEGMENT_BUCKETS] = allocate_segment();
+        }
+
+        uint32_t sequence = meta->sequence.load(std::memory_order_relaxed);
+        meta->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        // 取下旧桶链上的全部键值，链首桶的版本号保留
+        HashBucket* bucket = get_bucket(old_index);
+        uint32_t saved_count = bucket->count;
+        uint32_t saved_keys[HashBucket::SLOTS];
+        uint64_t saved_values[HashBucket::SLOTS];
+        memcpy(saved_keys, bucket->keys, sizeof(saved_keys));
+        memcpy(saved_values, bucket->values, sizeof(saved_values));
+        uint64_t next = bucket->overflow;
+        bucket->count = 0;
+        bucket->overflow = 0;
+
+        meta->split++;
+        if (meta->split == (HashMeta::SEGMENT_BUCKETS << meta->level)) {
+            meta->level++;
+            meta->split = 0;
+        }
+
+        // 按新的模数重新分配到旧桶和新桶
+        for (uint32_t i = 0; i < saved_count; i++) {
+            append(get_bucket(bucket_index(saved_keys[i])), saved_keys[i], saved_values[i]);
+        }
+        while (next) {
+            HashBucket* current = get_overflow(next);
+            for (uint32_t i = 0; i < current->count; i++) {
+                uint32_t index = bucket_index(current->keys[i]);
+                append(get_bucket(index), current->keys[i], current->values[i]);
+            }
+            // 归还溢出桶
+            uint64_t offset = next;
+            next = current->overflow;
+            current->overflow = meta->free_overflow;
+            meta->free_overflow = offset;
+        }
+
+        meta->sequence.store(sequence + 2, std::memory_order_release);
+    }
+};
@@ -1,50 +1,254 @@
 #pragma once
 #include "optimized_db.h"
 #include <algorithm>
+#include <atomic>
+#include <functional>
+#include <stddef.h>
+#include <string>
 
 // B+树节点结构
+// version 为乐观锁版本号：bit1 表示写锁，每次写解锁版本号加 2。
+// 读者不加锁，读完后比较版本号，变化则重试。
 struct IndexNode {
     static const int MAX_KEYS = 64;
-    uint32_t keys[MAX_KEYS];     // 键值数组
+    std::atomic<uint64_t> version; // 乐观锁版本号
+    uint64_t keys[MAX_KEYS];     // 键值数组
     uint64_t children[MAX_KEYS + 1]; // 子节点或数据指针
     uint32_t count;        // 当前键值数量
     bool is_leaf;          // 是否是叶子节点
     uint64_t next;         // 叶子节点链表（用于范围查询）
+    uint64_t prev;         // 反向叶子节点链表（用于反向遍历）
+
+    // 经过本节点、尚未更新完计数的写者数，分裂前需等待归零。
+    // 单独占一个缓存行，写者登记不会使只读版本号和键的读者缓存失效
+    alignas(64) std::atomic<uint32_t> writers;
+
+    // 聚合信息：内部节点记录每个子树的索引项数量和记录字节数，
+    // 叶子节点记录每条记录的字节数，计数和选择查询不需要读取记录。
+    // 内部节点的计数由写者原子地增减，不加锁也不改变版本号
+    std::atomic<uint32_t> counts[MAX_KEYS + 1];
+    uint32_t sizes[MAX_KEYS];
+    std::atomic<uint64_t> bytes[MAX_KEYS + 1];
+};
+
+// 索引元数据块，位于索引文件开头，打开时只需校验即可使用。
+// 槽位 0 为主键索引，其余为二级索引。
+struct IndexMeta {
+    static const int MAX_INDEXES = 8;
+    struct alignas(64) Tree {
+        char name[32];                  // 索引名称
+        std::atomic<uint64_t> root;     // 根节点偏移，0 表示空槽位
+        std::atomic<uint64_t> count;    // 索引项数量，关闭时从根节点汇总，打开期间不维护
+        uint32_t height;                // 树高
+        std::atomic<uint32_t> stale;    // 提取函数未声明期间记录有变化，重新声明时需重建
+    };
+
+    char magic[4];          // 魔数 "MMIX"
+    uint32_t version;       // 索引文件版本号
+    uint32_t clean;         // 正常关闭标志，打开期间为 0
+    uint32_t next_key;      // 下一个可用的键值
+    uint64_t checksum;      // 除本字段外整个元数据块的校验和
+    uint64_t data_end;      // 关闭时数据文件的 data_start，用于检查两个文件是否一致
+    uint64_t node_end;      // 索引文件中下一个可分配的位置
+    Tree trees[MAX_INDEXES + 1];
+};
+
+// 记录视图，直接指向映射区中的数据，不做拷贝
+struct RecordView {
+    const void* data;
+    uint32_t size;
 };
 
 class IndexedDB : public OptimizedDB {
 private:
-    IndexNode* root;
-    uint64_t root_offset;  // 根节点在文件中的偏移
-    uint32_t next_key;     // 下一个可用的键值
-    
+    static const uint32_t INDEX_VERSION = 10;  // 写者登记计数单独占缓存行
+    static const uint64_t LOCKED_BIT = 2;
+    static const int MAX_HEIGHT = 16;
+    static const size_t INDEX_INITIAL_SIZE = 64 * 1024;
+
+    IndexMeta* meta;                    // 索引元数据
+    std::atomic<uint32_t> next_key;     // 下一个可用的键值
+    std::mutex alloc_mutex;             // 保护数据文件尾部空间分配
+
+    // 索引节点保存在独立的索引文件（<数据文件名>.idx）中，
+    // 连续存放，不与记录交错，可以单独锁定在内存中
+    int index_fd;
+    char* index_addr;                   // 索引文件映射基地址，扩展时不变
+    size_t index_size;                  // 索引文件映射大小
+    size_t index_reserved;              // 预留地址空间大小
+    bool index_pinned;                  // 是否已 mlock
+    std::mutex node_mutex;              // 保护索引文件空间分配
+
+public:
+    // 二级索引键提取函数，从记录内容中计算索引键
+    typedef std::function<uint32_t(const void* data, size_t size)> KeyExtractor;
+
+private:
+    KeyExtractor extractors[IndexMeta::MAX_INDEXES + 1];
+
 protected:
     using OptimizedDB::addr;
     using OptimizedDB::header;
     using OptimizedDB::get_record;
-    
+
 public:
-    IndexedDB(const char* filename) : OptimizedDB(filename), root(nullptr), next_key(1) {
-        if (header->version == 1) {
-            // 新数据库，创建索引
-            create_index();
+    IndexedDB(const char* filename) : OptimizedDB(filename), meta(nullptr), next_key(1),
+        index_fd(-1), index_addr(nullptr), index_size(0), index_reserved(0), index_pinned(false) {
+        // 数据文件只包含记录，索引全部在索引文件中
+        if (header->version != 1) {
+            throw "Unsupported database version";
+        }
+
+        bool is_new = open_index_file((std::string(filename) + ".idx").c_str());
+        meta = reinterpret_cast<IndexMeta*>(index_addr);
+        if (!is_new && memcmp(meta->magic, "MMIX", 4) == 0 &&
+            meta->version == INDEX_VERSION && meta->clean == 1 &&
+            meta->checksum == meta_checksum() && meta->data_end == header->data_start) {
+            // 元数据完整且与数据文件一致，O(1) 打开
+            next_key = meta->next_key;
         } else {
-            // 加载已有索引
-            root_offset = header->free_start;  // 使用 free_start 存储根节点位置
-            root = get_node(root_offset);
+            // 新索引文件、上次未正常关闭、元数据损坏或数据文件已变化，从记录重建索引
+            rebuild_index();
+        }
+        meta->clean = 0;
+        msync(index_addr, 4096, MS_SYNC);
+    }
+
+    ~IndexedDB() override {
+        // 保存元数据并标记正常关闭，索引项数量从根节点的子树计数汇总
+        for (int i = 0; i <= IndexMeta::MAX_INDEXES; i++) {
+            IndexMeta::Tree& tree = meta->trees[i];
+            if (!tree.root) continue;
+            uint32_t count;
+            uint64_t bytes;
+            node_totals(get_node(tree.root), &count, &bytes);
+            tree.count = count;
         }
+        meta->next_key = next_key;
+        meta->data_end = header->data_start;
+        meta->clean = 1;
+        meta->checksum = meta_checksum();
+
+        msync(index_addr, index_size, MS_SYNC);
+        munmap(index_addr, index_reserved);
+        close(index_fd);
+    }
+
+    // 将索引文件锁定在内存中，之后扩展的部分同样锁定
+    bool pin_index() {
+        std::lock_guard<std::mutex> lock(node_mutex);
+        if (mlock(index_addr, index_size) != 0) {
+            return false;
+        }
+        index_pinned = true;
+        return true;
     }
 
     // 重写写入方法，维护索引
     uint64_t write(const void* data, size_t size) override {
-        uint64_t pos = OptimizedDB::write(data, size);
-        if (pos) {
-            // 使用自增键值作为索引
-            insert_index(next_key++, pos);
+        uint64_t pos;
+        uint32_t id;
+        {
+            // 键值与记录在同一把锁内分配，保证键值等于记录在文件中的序号，
+            // 重建索引时可以据此恢复
+            std::lock_guard<std::mutex> lock(alloc_mutex);
+            pos = OptimizedDB::write(data, size);
+            if (pos == 0) return 0;
+            id = next_key++;
         }
+        index_record(id, pos, data, size);
         return pos;
     }
 
+    // 批量写入，整批记录和键值在一次加锁内连续分配，之后逐条维护索引。
+    // 基类的批量写入绕过 write，既不分配键值也不维护索引，重建时键值会与记录序号错位
+    void batch_write(const std::vector<std::pair<const void*, size_t>>& records,
+                     std::vector<uint64_t>& positions) {
+        size_t first = positions.size();
+        uint32_t id;
+        {
+            std::lock_guard<std::mutex> lock(alloc_mutex);
+            id = next_key;
+            for (const auto& record : records) {
+                uint64_t pos = OptimizedDB::write(record.first, record.second);
+                positions.push_back(pos);
+                if (pos) next_key++;
+            }
+        }
+        for (size_t i = 0; i < records.size(); i++) {
+            if (positions[first + i] == 0) continue;
+            index_record(id++, positions[first + i], records[i].first, records[i].second);
+        }
+    }
+
+    // 删除记录，同时移除主键索引和二级索引项。
+    // 主键索引项尚不可见（写入未完成）的记录不能删除，返回 false
+    bool remove(uint64_t pos) override {
+        if (pos >= header->data_start) return false;
+        RecordHeader* rec = get_record(pos);
+        if (rec->flags & 1) return false;
+
+        // 键值与记录位置同样随写入递增，按键值二分查找主键：每次按键定位到第一个 >= mid 的
+        // 索引项并比较记录位置，不依赖会随并发删除变化的序号
+        uint64_t lo = 0, hi = next_key.load();
+        bool found = false;
+        uint32_t id = 0;
+        while (lo < hi && !found) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            Cursor it = seek((uint32_t)mid);
+            if (it.valid() && it.position() == pos) {
+                id = it.key();
+                found = true;
+            } else if (it.valid() && it.position() < pos) {
+                lo = (uint64_t)it.key() + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (!found || !erase_index(meta->trees[0], id)) return false;
+
+        // 主键已知，直接按 (索引键, 主键) 删除二级索引项
+        for (int i = 1; i <= IndexMeta::MAX_INDEXES; i++) {
+            if (!extractors[i]) {
+                mark_stale(i);
+                continue;
+            }
+            uint64_t key = (uint64_t)extractors[i](rec + 1, rec->size) << 32 | id;
+            erase_index(meta->trees[i], key);
+        }
+        return OptimizedDB::remove(pos);
+    }
+
+    // 声明二级索引，返回索引句柄。
+    // 同名索引已存在时直接复用，否则新建并用已有记录回填。
+    // 提取函数不持久化，每次打开数据库后需要重新声明，且应在并发访问前完成；
+    // 声明之前写入或删除过记录时，已持久化的索引不再准确，会从记录重建。
+    int add_index(const char* name, KeyExtractor extractor) {
+        int slot = 0;
+        for (int i = 1; i <= IndexMeta::MAX_INDEXES; i++) {
+            IndexMeta::Tree& tree = meta->trees[i];
+            if (tree.root && strncmp(tree.name, name, sizeof(tree.name)) == 0) {
+                if (tree.stale.load()) {
+                    fill_index(i, extractor);
+                    tree.stale = 0;
+                }
+                extractors[i] = extractor;
+                return i;
+            }
+            if (!tree.root && slot == 0) slot = i;
+        }
+        if (slot == 0) {
+            throw "Too many indexes";
+        }
+
+        IndexMeta::Tree& tree = meta->trees[slot];
+        strncpy(tree.name, name, sizeof(tree.name) - 1);
+        tree.name[sizeof(tree.name) - 1] = '\0';
+        fill_index(slot, extractor);
+        extractors[slot] = extractor;
+        return slot;
+    }
+
     // 使用索引进行查找
     bool read_by_id(uint32_t id, void* buffer, size_t* size) {
         uint64_t pos = find_by_index(id);
@@ -52,190 +256,1156 @@ public:
         return read(pos, buffer, size);
     }
 
+    // 批量点查询，返回与 ids 顺序一致的记录位置，不存在为 0。
+    // 键排序后依次查找，落在同一叶子中的键共享一次从根下降和叶子复制
+    std::vector<uint64_t> multi_get(const std::vector<uint32_t>& ids) {
+        std::vector<uint64_t> positions(ids.size(), 0);
+        std::vector<uint32_t> order(ids.size());
+        for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [&ids](uint32_t a, uint32_t b) {
+            return ids[a] < ids[b];
+        });
+
+        uint64_t keys[IndexNode::MAX_KEYS];
+        uint64_t values[IndexNode::MAX_KEYS];
+        uint32_t count = 0;
+        bool loaded = false;
+        for (uint32_t i : order) {
+            uint64_t key = ids[i];
+            // 叶子内的键连续，键在副本的首尾之间时副本就能给出结果
+            if (!loaded || count == 0 || key < keys[0] || key > keys[count - 1]) {
+                while (true) {
+                    uint64_t version;
+                    IndexNode* leaf = find_leaf(meta->trees[0].root, key, version);
+                    count = std::min<uint32_t>(leaf->count, IndexNode::MAX_KEYS);
+                    memcpy(keys, leaf->keys, count * sizeof(uint64_t));
+                    memcpy(values, leaf->children, count * sizeof(uint64_t));
+                    if (validate(leaf, version)) break;
+                }
+                loaded = true;
+            }
+
+            uint64_t* found = std::lower_bound(keys, keys + count, key);
+            if (found != keys + count && *found == key) {
+                positions[i] = values[found - keys];
+                __builtin_prefetch(get_record(positions[i]));
+            }
+        }
+        return positions;
+    }
+
+    // 游标：沿叶子链表惰性遍历，每次复制一个叶子的键值对，不分配内存
+    class Cursor {
+    public:
+        bool valid() const { return pos < count; }
+        uint32_t key() const { return (uint32_t)(entries[pos].first >> key_shift); }
+        uint64_t position() const { return entries[pos].second; }
+
+        // 当前记录视图，在数据库关闭前有效
+        RecordView record() const {
+            RecordHeader* rec = db->get_record(entries[pos].second);
+            return {rec + 1, rec->size};
+        }
+
+        void next() {
+            pos++;
+            settle(true);
+        }
+
+        void prev() {
+            if (pos == 0) {
+                pos = count;
+                step_leaf(false);
+            } else {
+                pos--;
+            }
+            settle(false);
+        }
+
+    private:
+        friend class IndexedDB;
+        static const uint32_t PREFETCH_DISTANCE = 8;
+
+        IndexedDB* db;
+        std::atomic<uint64_t>* root;  // 遍历的索引树
+        int key_shift;           // 二级索引键位于高 32 位
+        uint64_t leaf_offset;    // 当前叶子偏移
+        uint64_t leaf_version;   // 复制时的叶子版本号
+        uint64_t sibling[2];     // 复制时的 prev/next 指针
+        uint64_t resume_key;     // 叶子失效后重新定位使用的键
+        bool exhausted;          // 已越过链表端点
+        uint32_t count;
+        uint32_t pos;
+        std::pair<uint64_t, uint64_t> entries[IndexNode::MAX_KEYS];
+
+        Cursor(IndexedDB* owner, int index) : db(owner), root(&owner->meta->trees[index].root),
+            key_shift(index == 0 ? 0 : 32), leaf_offset(0), leaf_version(0),
+            sibling{0, 0}, resume_key(0), exhausted(false), count(0), pos(0) {}
+
+        // 复制叶子内容，版本校验失败返回 false
+        bool load(uint64_t offset, uint64_t version) {
+            IndexNode* leaf = db->get_node(offset);
+            uint32_t n = std::min<uint32_t>(leaf->count, IndexNode::MAX_KEYS);
+            for (uint32_t i = 0; i < n; i++) {
+                entries[i] = {leaf->keys[i], leaf->children[i]};
+            }
+            sibling[0] = leaf->prev;
+            sibling[1] = leaf->next;
+            if (!db->validate(leaf, version)) return false;
+
+            leaf_offset = offset;
+            leaf_version = version;
+            count = n;
+            return true;
+        }
+
+        // 从根节点定位到包含 key 的叶子
+        void seek(uint64_t key, bool forward) {
+            resume_key = key;
+            while (true) {
+                uint64_t version;
+                IndexNode* leaf = db->find_leaf(*root, key, version);
+                uint64_t offset = reinterpret_cast<char*>(leaf) - db->index_addr;
+                if (load(offset, version)) break;
+            }
+            if (forward) {
+                pos = 0;
+                while (pos < count && entries[pos].first < key) pos++;
+            } else {
+                pos = count;
+                while (pos > 0 && entries[pos - 1].first > key) pos--;
+                if (pos == 0) {
+                    pos = count;
+                    step_leaf(false);
+                } else {
+                    pos--;
+                }
+            }
+            settle(forward);
+        }
+
+        // 移动到相邻叶子；当前叶子已被修改时从根重新定位
+        void step_leaf(bool forward) {
+            if (count > 0) {
+                if (forward) {
+                    if (entries[count - 1].first == UINT64_MAX) {
+                        exhausted = true;
+                        return;
+                    }
+                    resume_key = entries[count - 1].first + 1;
+                } else {
+                    if (entries[0].first == 0) {
+                        exhausted = true;
+                        return;
+                    }
+                    resume_key = entries[0].first - 1;
+                }
+            }
+
+            uint64_t offset = sibling[forward ? 1 : 0];
+            if (offset == 0) {
+                exhausted = true;
+                return;
+            }
+            IndexNode* current = db->get_node(leaf_offset);
+            IndexNode* leaf = db->get_node(offset);
+            uint64_t version = db->read_lock(leaf);
+            // 当前叶子未变化，说明兄弟指针仍然有效
+            if (!db->validate(current, leaf_version) || !load(offset, version)) {
+                seek(resume_key, forward);
+                return;
+            }
+            pos = forward ? 0 : count;
+            if (!forward && count > 0) pos--;
+        }
+
+        // 跳过空叶子和已删除记录，并预取后续数据
+        void settle(bool forward) {
+            while (!exhausted) {
+                if (pos >= count) {
+                    step_leaf(forward);
+                    if (exhausted) break;
+                    if (count == 0) continue;
+                }
+                RecordHeader* rec = db->get_record(entries[pos].second);
+                if (!(rec->flags & 1)) break;
+                if (forward) {
+                    pos++;
+                } else if (pos == 0) {
+                    pos = count;
+                    step_leaf(false);
+                } else {
+                    pos--;
+                }
+            }
+            if (exhausted) {
+                pos = count;
+                return;
+            }
+
+            // 预取后续记录和下一个叶子
+            uint32_t ahead = forward ? pos + PREFETCH_DISTANCE : pos - PREFETCH_DISTANCE;
+            if (ahead < count) {
+                __builtin_prefetch(db->get_record(entries[ahead].second));
+            }
+            if (pos == (forward ? 0 : count - 1) && sibling[forward ? 1 : 0]) {
+                __builtin_prefetch(db->get_node(sibling[forward ? 1 : 0]));
+                for (uint32_t i = 0; i < PREFETCH_DISTANCE && i < count; i++) {
+                    uint32_t j = forward ? i : count - 1 - i;
+                    __builtin_prefetch(db->get_record(entries[j].second));
+                }
+            }
+        }
+    };
+
+    // 定位到第一个 >= key 的记录
+    Cursor seek(uint32_t key) {
+        Cursor cursor(this, 0);
+        cursor.seek(key, true);
+        return cursor;
+    }
+
+    // 定位到最后一个 <= key 的记录，用于反向遍历
+    Cursor seek_last(uint32_t key) {
+        Cursor cursor(this, 0);
+        cursor.seek(key, false);
+        return cursor;
+    }
+
+    // 在二级索引上定位到第一个索引键 >= key 的记录
+    Cursor seek_by(int index, uint32_t key) {
+        Cursor cursor(this, index);
+        cursor.seek((uint64_t)key << 32, true);
+        return cursor;
+    }
+
+    // 在二级索引上定位到最后一个索引键 <= key 的记录
+    Cursor seek_last_by(int index, uint32_t key) {
+        Cursor cursor(this, index);
+        cursor.seek((uint64_t)key << 32 | UINT32_MAX, false);
+        return cursor;
+    }
+
+    // 按二级索引键查找，返回所有匹配记录的位置
+    std::vector<uint64_t> find_by(int index, uint32_t key) {
+        std::vector<uint64_t> results;
+        for (Cursor it = seek_by(index, key); it.valid() && it.key() == key; it.next()) {
+            results.push_back(it.position());
+        }
+        return results;
+    }
+
+    // 二级索引范围查询，返回 (索引键, 记录位置)
+    std::vector<std::pair<uint32_t, uint64_t>> range_by(int index, uint32_t start_key, uint32_t end_key) {
+        std::vector<std::pair<uint32_t, uint64_t>> results;
+        for (Cursor it = seek_by(index, start_key); it.valid() && it.key() <= end_key; it.next()) {
+            results.push_back({it.key(), it.position()});
+        }
+        return results;
+    }
+
+    // 树上计算的聚合结果
+    struct Aggregate {
+        uint64_t count;         // 索引项数量
+        uint32_t min_key;       // 最小键，count 为 0 时无意义
+        uint32_t max_key;       // 最大键
+        uint64_t total_bytes;   // 记录字节数之和
+    };
+
+    // 统计主键在 [start_key, end_key] 内的记录数，O(log n)
+    uint64_t count_range(uint32_t start_key, uint32_t end_key) {
+        return aggregate(start_key, end_key).count;
+    }
+
+    // 统计二级索引键在 [start_key, end_key] 内的记录数
+    uint64_t count_range_by(int index, uint32_t start_key, uint32_t end_key) {
+        return aggregate_by(index, start_key, end_key).count;
+    }
+
+    // 按主键顺序取第 k 条记录（从 0 开始），O(log n)
+    bool select(uint64_t k, uint32_t* id, uint64_t* pos) {
+        uint64_t key;
+        if (!select_entry(meta->trees[0], k, &key, pos)) return false;
+        *id = (uint32_t)key;
+        return true;
+    }
+
+    // 按二级索引键顺序取第 k 条记录
+    bool select_by(int index, uint64_t k, uint32_t* key, uint64_t* pos) {
+        uint64_t full_key;
+        if (!select_entry(meta->trees[index], k, &full_key, pos)) return false;
+        *key = (uint32_t)(full_key >> 32);
+        return true;
+    }
+
+    // 主键范围内的聚合值，只访问索引节点，不读取记录
+    Aggregate aggregate(uint32_t start_key, uint32_t end_key) {
+        return aggregate_tree(meta->trees[0], start_key, end_key, 0);
+    }
+
+    // 二级索引键范围内的聚合值
+    Aggregate aggregate_by(int index, uint32_t start_key, uint32_t end_key) {
+        return aggregate_tree(meta->trees[index], (uint64_t)start_key << 32,
+                              (uint64_t)end_key << 32 | UINT32_MAX, 32);
+    }
+
+    // 并行扫描回调，参数为键值和记录视图，会在多个线程中并发调用
+    typedef std::function<void(uint32_t, const RecordView&)> ScanCallback;
+
+    // 并行范围扫描：按子树计数把 [start_key, end_key] 切成索引项数量相近的分区，
+    // 工作线程逐个领取分区并用游标遍历，thread_count 为 0 时使用全部核心
+    void parallel_range(uint32_t start_key, uint32_t end_key, const ScanCallback& callback,
+                        size_t thread_count = 0) {
+        parallel_scan(0, start_key, end_key, callback, thread_count);
+    }
+
+    // 二级索引键上的并行范围扫描，回调参数为索引键
+    void parallel_range_by(int index, uint32_t start_key, uint32_t end_key,
+                           const ScanCallback& callback, size_t thread_count = 0) {
+        parallel_scan(index, (uint64_t)start_key << 32, (uint64_t)end_key << 32 | UINT32_MAX,
+                      callback, thread_count);
+    }
+
     // 范围查询
     std::vector<std::pair<uint32_t, uint64_t>> range_query(uint32_t start_key, uint32_t end_key) {
         std::vector<std::pair<uint32_t, uint64_t>> results;
-        
-        // 找到起始叶子节点
-        IndexNode* leaf = find_leaf(start_key);
-        while (leaf) {
-            // 遍历叶子节点
-            for (uint32_t i = 0; i < leaf->count; i++) {
-                if (leaf->keys[i] >= start_key && leaf->keys[i] <= end_key) {
-                    results.push_back({leaf->keys[i], leaf->children[i]});
-                } else if (leaf->keys[i] > end_key) {
-                    return results;
-                }
-            }
-            
-            // 移动到下一个叶子节点
-            if (leaf->next == 0) break;
-            leaf = get_node(leaf->next);
-        }
-        
+        for (Cursor it = seek(start_key); it.valid() && it.key() <= end_key; it.next()) {
+            results.push_back({it.key(), it.position()});
+        }
         return results;
     }
 
 private:
-    // 创建索引
-    void create_index() {
-        // 分配根节点空间
-        root_offset = header->data_start;
-        header->data_start += sizeof(IndexNode);
-        header->free_start = root_offset;  // 存储根节点位置
-        root = get_node(root_offset);
-        
+    // 读取版本号，等待写锁释放
+    uint64_t read_lock(IndexNode* node) {
+        uint64_t version = node->version.load(std::memory_order_acquire);
+        for (int spins = 0; version & LOCKED_BIT; spins++) {
+            if (spins > 64) std::this_thread::yield();
+            version = node->version.load(std::memory_order_acquire);
+        }
+        return version;
+    }
+
+    // 校验读取期间节点未被修改
+    bool validate(IndexNode* node, uint64_t version) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return node->version.load(std::memory_order_relaxed) == version;
+    }
+
+    // 将乐观读升级为写锁，失败说明节点已被修改
+    bool upgrade_lock(IndexNode* node, uint64_t version) {
+        return node->version.compare_exchange_strong(
+            version, version + LOCKED_BIT, std::memory_order_acquire);
+    }
+
+    void write_unlock(IndexNode* node) {
+        node->version.fetch_add(LOCKED_BIT, std::memory_order_release);
+    }
+
+    // 加写锁，等待其他写者释放，返回加锁前的版本号
+    uint64_t write_lock(IndexNode* node) {
+        while (true) {
+            uint64_t version = read_lock(node);
+            if (upgrade_lock(node, version)) return version;
+        }
+    }
+
+    // 登记为经过该节点的写者，节点在读取 version 之后被加锁或修改时失败。
+    // 登记期间节点不会分裂，子节点指针和计数的位置保持不变
+    bool enter_node(IndexNode* node, uint64_t version) {
+        node->writers.fetch_add(1, std::memory_order_seq_cst);
+        if (node->version.load(std::memory_order_seq_cst) == version) return true;
+        node->writers.fetch_sub(1, std::memory_order_release);
+        return false;
+    }
+
+    // 撤销路径上前 depth 个节点的登记
+    void leave_path(IndexNode** path, int depth) {
+        for (int d = 0; d < depth; d++) {
+            path[d]->writers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    // 已加锁的节点等待登记的写者全部离开，之后才能移动计数。
+    // 登记的写者遇到加锁的节点会撤销登记并重试，不会反过来等待
+    void wait_writers(IndexNode* node) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (int spins = 0; node->writers.load(std::memory_order_acquire) != 0; spins++) {
+            if (spins > 64) std::this_thread::yield();
+        }
+    }
+
+    // 打开或创建索引文件，返回是否为新建
+    bool open_index_file(const char* filename) {
+        index_fd = open(filename, O_RDWR | O_CREAT, 0644);
+        if (index_fd == -1) {
+            throw "Cannot open index file";
+        }
+
+        struct stat st;
+        if (fstat(index_fd, &st) == -1) {
+            close(index_fd);
+            throw "Cannot get index file size";
+        }
+        bool is_new = (size_t)st.st_size < sizeof(IndexMeta);
+        index_size = is_new ? INDEX_INITIAL_SIZE : st.st_size;
+        if (is_new && ftruncate(index_fd, index_size) == -1) {
+            close(index_fd);
+            throw "Cannot set index file size";
+        }
+
+        // 与数据文件相同，预留地址空间后原地扩展
+        index_reserved = index_size > RESERVED_SIZE ? index_size : RESERVED_SIZE;
+        void* base = mmap(NULL, index_reserved, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED ||
+            mmap(base, index_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, index_fd, 0) == MAP_FAILED) {
+            if (base != MAP_FAILED) munmap(base, index_reserved);
+            close(index_fd);
+            throw "Cannot map index file";
+        }
+        index_addr = static_cast<char*>(base);
+
+        #ifdef MADV_HUGEPAGE
+        madvise(index_addr, index_size, MADV_HUGEPAGE);
+        #endif
+        return is_new;
+    }
+
+    // 扩展索引文件，只映射新增部分
+    bool extend_index(size_t new_size) {
+        if (new_size > index_reserved || ftruncate(index_fd, new_size) == -1) {
+            return false;
+        }
+        char* tail = index_addr + index_size;
+        if (mmap(tail, new_size - index_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, index_fd, index_size) == MAP_FAILED) {
+            return false;
+        }
+        #ifdef MADV_HUGEPAGE
+        madvise(tail, new_size - index_size, MADV_HUGEPAGE);
+        #endif
+        if (index_pinned) {
+            mlock(tail, new_size - index_size);
+        }
+        index_size = new_size;
+        return true;
+    }
+
+    // 重置元数据，索引文件中已有的节点全部丢弃
+    void reset_meta() {
+        memset(static_cast<void*>(meta), 0, sizeof(IndexMeta));
+        memcpy(meta->magic, "MMIX", 4);
+        meta->version = INDEX_VERSION;
+        meta->node_end = (sizeof(IndexMeta) + 63) & ~(uint64_t)63;
+
+        IndexMeta::Tree& tree = meta->trees[0];
+        strcpy(tree.name, "id");
+        tree.count = 0;
+        tree.height = 1;
+    }
+
+    // 为新写入的记录插入索引项
+    void index_record(uint32_t id, uint64_t pos, const void* data, size_t size) {
+        // 维护二级索引，键为 (索引键, 主键) 以保证唯一。
+        // 二级索引项先于主键索引项插入：能经由主键找到的记录，二级索引项都已就位，
+        // 并发删除不会漏掉尚未插入的项
+        for (int i = 1; i <= IndexMeta::MAX_INDEXES; i++) {
+            if (!extractors[i]) {
+                mark_stale(i);
+                continue;
+            }
+            uint64_t key = (uint64_t)extractors[i](data, size) << 32 | id;
+            insert_index(meta->trees[i], key, pos, size);
+        }
+
+        // 使用自增键值作为索引
+        insert_index(meta->trees[0], id, pos, size);
+    }
+
+    // 已持久化但尚未重新声明的二级索引无法维护，标记为过期
+    void mark_stale(int index) {
+        IndexMeta::Tree& tree = meta->trees[index];
+        if (tree.root.load(std::memory_order_relaxed) && !tree.stale.load(std::memory_order_relaxed)) {
+            tree.stale.store(1, std::memory_order_relaxed);
+        }
+    }
+
+    // 新建一棵空树并用已有记录填充，旧树的节点直接丢弃
+    void fill_index(int index, const KeyExtractor& extractor) {
+        IndexMeta::Tree& tree = meta->trees[index];
+        tree.count = 0;
+        tree.height = 1;
+        tree.root = create_tree();
+        for (Cursor it = seek(0); it.valid(); it.next()) {
+            RecordView rec = it.record();
+            uint64_t key = (uint64_t)extractor(rec.data, rec.size) << 32 | it.key();
+            insert_index(tree, key, it.position(), rec.size);
+        }
+    }
+
+    // 元数据校验和（FNV-1a），跳过 checksum 字段本身
+    uint64_t meta_checksum() {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(meta);
+        size_t skip = offsetof(IndexMeta, checksum);
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < sizeof(IndexMeta); i++) {
+            if (i >= skip && i < skip + sizeof(meta->checksum)) continue;
+            hash = (hash ^ p[i]) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+public:
+    // 从记录重建主键索引，索引文件缺失、元数据损坏或上次未正常关闭时在打开过程中自动调用。
+    // 顺序遍历记录链收集记录位置后，多线程并行填充叶子，再自底向上构建内部节点。
+    // 二级索引会被清空，重新声明时自动回填。调用期间不能有其他并发操作。
+    void rebuild_index() {
+        // 数据文件只包含记录，只需读取记录头；已删除记录占用键值但不进入索引
+        struct Entry {
+            uint32_t id;
+            uint32_t size;
+            uint64_t pos;
+        };
+        std::vector<Entry> entries;
+        uint32_t id = 0;
+        uint64_t pos = sizeof(DBHeader);
+        while (pos + sizeof(RecordHeader) <= header->data_start) {
+            RecordHeader* rec = get_record(pos);
+            if (rec->next <= pos) break;
+            id++;
+            if (!(rec->flags & 1)) entries.push_back({id, rec->size, pos});
+            pos = rec->next;
+        }
+
+        reset_meta();
+        for (int i = 1; i <= IndexMeta::MAX_INDEXES; i++) {
+            extractors[i] = nullptr;
+        }
+
+        size_t n = entries.size();
+        next_key = id + 1;
+        if (n == 0) {
+            meta->trees[0].root = create_tree();
+            return;
+        }
+
+        // 所有叶子连续分配，按键序排列
+        size_t leaf_count = (n + IndexNode::MAX_KEYS - 1) / IndexNode::MAX_KEYS;
+        uint64_t base = allocate(leaf_count * sizeof(IndexNode));
+
+        size_t thread_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+        thread_count = std::min(thread_count, leaf_count);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < thread_count; t++) {
+            size_t begin = leaf_count * t / thread_count;
+            size_t end = leaf_count * (t + 1) / thread_count;
+            workers.emplace_back([this, &entries, base, begin, end, leaf_count, n]() {
+                for (size_t l = begin; l < end; l++) {
+                    IndexNode* leaf = get_node(base + l * sizeof(IndexNode));
+                    size_t first = l * IndexNode::MAX_KEYS;
+                    leaf->version.store(0, std::memory_order_relaxed);
+                    leaf->writers.store(0, std::memory_order_relaxed);
+                    leaf->is_leaf = true;
+                    leaf->count = std::min<size_t>(IndexNode::MAX_KEYS, n - first);
+                    for (uint32_t i = 0; i < leaf->count; i++) {
+                        leaf->keys[i] = entries[first + i].id;  // 键值即记录序号
+                        leaf->children[i] = entries[first + i].pos;
+                        leaf->sizes[i] = entries[first + i].size;
+                    }
+                    leaf->prev = l > 0 ? base + (l - 1) * sizeof(IndexNode) : 0;
+                    leaf->next = l + 1 < leaf_count ? base + (l + 1) * sizeof(IndexNode) : 0;
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        // 自底向上构建内部节点，每层保存子树最小键、节点偏移和聚合信息
+        struct Subtree {
+            uint64_t first_key;
+            uint64_t offset;
+            uint32_t count;
+            uint64_t bytes;
+        };
+        std::vector<Subtree> level(leaf_count);
+        for (size_t l = 0; l < leaf_count; l++) {
+            uint64_t offset = base + l * sizeof(IndexNode);
+            IndexNode* leaf = get_node(offset);
+            uint64_t bytes = 0;
+            for (uint32_t i = 0; i < leaf->count; i++) bytes += leaf->sizes[i];
+            level[l] = {leaf->keys[0], offset, leaf->count, bytes};
+        }
+        uint32_t height = 1;
+        const size_t fanout = IndexNode::MAX_KEYS + 1;
+        while (level.size() > 1) {
+            size_t parent_count = (level.size() + fanout - 1) / fanout;
+            uint64_t parent_base = allocate(parent_count * sizeof(IndexNode));
+            std::vector<Subtree> parents(parent_count);
+            for (size_t p = 0; p < parent_count; p++) {
+                IndexNode* node = get_node(parent_base + p * sizeof(IndexNode));
+                size_t first = p * fanout;
+                size_t children = std::min(fanout, level.size() - first);
+                node->version.store(0, std::memory_order_relaxed);
+                node->writers.store(0, std::memory_order_relaxed);
+                node->is_leaf = false;
+                node->next = 0;
+                node->prev = 0;
+                node->count = children - 1;
+                Subtree& parent = parents[p];
+                parent = {level[first].first_key, parent_base + p * sizeof(IndexNode), 0, 0};
+                for (size_t c = 0; c < children; c++) {
+                    const Subtree& child = level[first + c];
+                    node->children[c] = child.offset;
+                    node->counts[c].store(child.count, std::memory_order_relaxed);
+                    node->bytes[c].store(child.bytes, std::memory_order_relaxed);
+                    if (c > 0) node->keys[c - 1] = child.first_key;
+                    parent.count += child.count;
+                    parent.bytes += child.bytes;
+                }
+            }
+            level.swap(parents);
+            height++;
+        }
+
+        IndexMeta::Tree& tree = meta->trees[0];
+        tree.count = n;
+        tree.height = height;
+        tree.root = level[0].offset;
+    }
+
+private:
+
+    // 创建一棵空树，返回根节点偏移
+    uint64_t create_tree() {
+        uint64_t offset = allocate_node();
+        IndexNode* root = get_node(offset);
+
         // 初始化根节点
+        root->version.store(0, std::memory_order_relaxed);
+        root->writers.store(0, std::memory_order_relaxed);
         root->count = 0;
         root->is_leaf = true;
         root->next = 0;
-        
-        // 更新版本号表示已创建索引
-        header->version = 2;
+        root->prev = 0;
+        return offset;
+    }
+
+    // 从索引文件尾部分配空间，按 64 字节对齐
+    uint64_t allocate(size_t size) {
+        std::lock_guard<std::mutex> lock(node_mutex);
+        uint64_t offset = meta->node_end;
+        uint64_t end = (offset + size + 63) & ~(uint64_t)63;
+        if (end > index_size) {
+            size_t new_size = index_size * 2;
+            while (new_size < end) {
+                new_size *= 2;
+            }
+            if (!extend_index(new_size)) {
+                throw "Cannot extend index";
+            }
+        }
+        meta->node_end = end;
+        return offset;
     }
 
     // 分配新节点
     uint64_t allocate_node() {
-        uint64_t offset = header->data_start;
-        header->data_start += sizeof(IndexNode);
-        return offset;
+        return allocate(sizeof(IndexNode));
     }
 
     // 获取节点指针
     IndexNode* get_node(uint64_t offset) {
-        return reinterpret_cast<IndexNode*>(static_cast<char*>(addr) + offset);
+        return reinterpret_cast<IndexNode*>(index_addr + offset);
     }
 
-    // 插入索引项
-    void insert_index(uint32_t key, uint64_t value) {
-        if (root->count == 0) {
-            // 首次插入
-            root->keys[0] = key;
-            root->children[0] = value;
-            root->count = 1;
-            return;
+    // 在内部节点中查找键所在的子节点下标
+    static uint32_t child_index(IndexNode* node, uint64_t key) {
+        uint32_t count = std::min<uint32_t>(node->count, IndexNode::MAX_KEYS);
+        uint32_t i = 0;
+        while (i < count && key >= node->keys[i]) {
+            i++;
         }
+        return i;
+    }
 
-        // 检查是否需要分裂根节点
-        if (root->count == IndexNode::MAX_KEYS) {
-            uint64_t new_root_offset = allocate_node();
-            IndexNode* new_root = get_node(new_root_offset);
-            
-            // 初始化新根节点
-            new_root->is_leaf = false;
-            new_root->count = 0;
-            
-            // 分裂旧根节点
-            uint64_t new_node_offset = split_node(root_offset);
-            
-            // 设置新根节点的子节点
-            new_root->children[0] = root_offset;
-            new_root->children[1] = new_node_offset;
-            new_root->keys[0] = get_node(new_node_offset)->keys[0];
-            new_root->count = 1;
-            
-            // 更新根节点
-            root_offset = new_root_offset;
-            root = new_root;
-            header->free_start = root_offset;
-        }
-
-        // 执行插入
-        insert_non_full(root_offset, key, value);
-    }
-
-    // 向非满节点插入
-    void insert_non_full(uint64_t node_offset, uint32_t key, uint64_t value) {
+    // 节点分裂结果
+    struct Split {
+        uint64_t offset;      // 新节点偏移
+        uint64_t separator;   // 上推到父节点的键
+        uint32_t count;       // 移到新节点的索引项数量
+        uint64_t bytes;       // 移到新节点的记录字节数
+    };
+
+    // 插入索引项。乐观下降，只锁住需要修改的节点：遇到满节点时锁住它和父节点分裂后重新开始，
+    // 否则只锁目标叶子。写者下降时登记在经过的内部节点上，叶子插入完成后再自底向上
+    // 原子地增加各层计数，读者先读到的上层计数不会超过随后读到的下层计数。
+    // 代价是每次插入都要原子地修改根节点的登记计数和目标子树计数（两到三个缓存行），
+    // 核数很多且插入密集时这些行会在核间传递；换来的是计数、选择查询和并行扫描分区
+    // 都能在 O(log n) 内得到精确结果，不需要汇总分片
+    void insert_index(IndexMeta::Tree& tree, uint64_t key, uint64_t value, uint32_t size) {
+        IndexNode* path[MAX_HEIGHT];
+        uint64_t versions[MAX_HEIGHT];
+        uint32_t slots[MAX_HEIGHT];
+    restart:
+        int depth = 0;
+        uint64_t node_offset = tree.root.load(std::memory_order_acquire);
         IndexNode* node = get_node(node_offset);
-        
+        uint64_t version = read_lock(node);
+        if (node_offset != tree.root.load(std::memory_order_acquire)) goto restart;
+
+        while (true) {
+            if (node->count == IndexNode::MAX_KEYS) {
+                // 撤销登记后锁住父节点和当前节点，等其他写者离开再分裂
+                leave_path(path, depth);
+                IndexNode* parent = depth > 0 ? path[depth - 1] : nullptr;
+                if (parent && !upgrade_lock(parent, versions[depth - 1])) goto restart;
+                if (!upgrade_lock(node, version)) {
+                    if (parent) write_unlock(parent);
+                    goto restart;
+                }
+                if (!parent && node_offset != tree.root.load(std::memory_order_acquire)) {
+                    write_unlock(node);
+                    goto restart;
+                }
+                if (parent) wait_writers(parent);
+                wait_writers(node);
+
+                Split split = split_node(node_offset);
+                if (parent) {
+                    insert_into_inner(parent, slots[depth - 1], split);
+                } else {
+                    make_root(tree, node_offset, split);
+                }
+                write_unlock(node);
+                if (parent) write_unlock(parent);
+                goto restart;
+            }
+            if (node->is_leaf) break;
+
+            if (!enter_node(node, version)) {
+                leave_path(path, depth);
+                goto restart;
+            }
+            path[depth] = node;
+            versions[depth] = version;
+            slots[depth] = child_index(node, key);
+            node_offset = node->children[slots[depth]];
+            depth++;
+
+            // 持有登记时不能等待加锁的节点，否则会与等待登记清空的分裂者互相等待
+            node = get_node(node_offset);
+            version = node->version.load(std::memory_order_acquire);
+            if (version & LOCKED_BIT) {
+                leave_path(path, depth);
+                goto restart;
+            }
+        }
+
+        // 只锁住目标叶子
+        if (!upgrade_lock(node, version)) {
+            leave_path(path, depth);
+            goto restart;
+        }
+        insert_into_leaf(node, key, value, size);
+        write_unlock(node);
+
+        for (int d = depth - 1; d >= 0; d--) {
+            path[d]->counts[slots[d]].fetch_add(1, std::memory_order_release);
+            path[d]->bytes[slots[d]].fetch_add(size, std::memory_order_release);
+            path[d]->writers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    // 向已加锁的非满叶子节点插入
+    void insert_into_leaf(IndexNode* node, uint64_t key, uint64_t value, uint32_t size) {
+        int i = node->count - 1;
+        while (i >= 0 && key < node->keys[i]) {
+            node->keys[i + 1] = node->keys[i];
+            node->children[i + 1] = node->children[i];
+            node->sizes[i + 1] = node->sizes[i];
+            i--;
+        }
+
+        node->keys[i + 1] = key;
+        node->children[i + 1] = value;
+        node->sizes[i + 1] = size;
+        node->count++;
+    }
+
+    // 第 i 个子节点分裂后，向已加锁且没有登记写者的非满内部节点插入分隔键和新子节点
+    void insert_into_inner(IndexNode* node, uint32_t i, const Split& split) {
+        for (uint32_t j = node->count; j > i; j--) {
+            node->keys[j] = node->keys[j - 1];
+            node->children[j + 1] = node->children[j];
+            node->counts[j + 1].store(node->counts[j].load(std::memory_order_relaxed),
+                                      std::memory_order_relaxed);
+            node->bytes[j + 1].store(node->bytes[j].load(std::memory_order_relaxed),
+                                     std::memory_order_relaxed);
+        }
+
+        node->keys[i] = split.separator;
+        node->children[i + 1] = split.offset;
+        node->counts[i + 1].store(split.count, std::memory_order_relaxed);
+        node->bytes[i + 1].store(split.bytes, std::memory_order_relaxed);
+        node->counts[i].fetch_sub(split.count, std::memory_order_relaxed);
+        node->bytes[i].fetch_sub(split.bytes, std::memory_order_relaxed);
+        node->count++;
+    }
+
+    // 计算节点的索引项总数和记录字节数
+    void node_totals(IndexNode* node, uint32_t* count, uint64_t* bytes) {
+        *count = 0;
+        *bytes = 0;
         if (node->is_leaf) {
-            // 在叶子节点中插入
-            int i = node->count - 1;
-            while (i >= 0 && key < node->keys[i]) {
-                node->keys[i + 1] = node->keys[i];
-                node->children[i + 1] = node->children[i];
-                i--;
-            }
-            
-            node->keys[i + 1] = key;
-            node->children[i + 1] = value;
-            node->count++;
-            
+            *count = node->count;
+            for (uint32_t i = 0; i < node->count; i++) *bytes += node->sizes[i];
         } else {
-            // 在内部节点中查找子节点
-            int i = node->count - 1;
-            while (i >= 0 && key < node->keys[i]) {
-                i--;
+            for (uint32_t i = 0; i <= node->count; i++) {
+                *count += node->counts[i].load(std::memory_order_relaxed);
+                *bytes += node->bytes[i].load(std::memory_order_relaxed);
             }
-            i++;
-            
-            uint64_t child_offset = node->children[i];
-            IndexNode* child = get_node(child_offset);
-            
-            // 如果子节点已满，需要分裂
-            if (child->count == IndexNode::MAX_KEYS) {
-                uint64_t new_child_offset = split_node(child_offset);
-                IndexNode* new_child = get_node(new_child_offset);
-                
-                if (key >= new_child->keys[0]) {
-                    child_offset = new_child_offset;
-                    child = new_child;
-                }
-            }
-            
-            insert_non_full(child_offset, key, value);
         }
     }
 
-    // 分裂节点
-    uint64_t split_node(uint64_t node_offset) {
-        IndexNode* old_node = get_node(node_offset);
+    // 根节点分裂后创建新根
+    void make_root(IndexMeta::Tree& tree, uint64_t left, const Split& split) {
+        uint64_t new_root_offset = allocate_node();
+        IndexNode* new_root = get_node(new_root_offset);
+
+        // 初始化新根节点
+        new_root->version.store(0, std::memory_order_relaxed);
+        new_root->writers.store(0, std::memory_order_relaxed);
+        new_root->is_leaf = false;
+        new_root->next = 0;
+        new_root->prev = 0;
+        new_root->children[0] = left;
+        new_root->children[1] = split.offset;
+        new_root->keys[0] = split.separator;
+        new_root->count = 1;
+        uint32_t left_count;
+        uint64_t left_bytes;
+        node_totals(get_node(left), &left_count, &left_bytes);
+        new_root->counts[0].store(left_count, std::memory_order_relaxed);
+        new_root->bytes[0].store(left_bytes, std::memory_order_relaxed);
+        new_root->counts[1].store(split.count, std::memory_order_relaxed);
+        new_root->bytes[1].store(split.bytes, std::memory_order_relaxed);
+
+        // 更新根节点，旧根仍被锁住，不会有并发的根分裂
+        tree.height++;
+        tree.root.store(new_root_offset, std::memory_order_release);
+    }
+
+    // 分裂已加锁且没有登记写者的节点，后半部分移到新节点
+    Split split_node(uint64_t node_offset) {
         uint64_t new_node_offset = allocate_node();
+        IndexNode* old_node = get_node(node_offset);
         IndexNode* new_node = get_node(new_node_offset);
-        
-        // 复制后半部分到新节点
+        Split split = {new_node_offset, 0, 0, 0};
+
         int mid = IndexNode::MAX_KEYS / 2;
+        new_node->version.store(0, std::memory_order_relaxed);
+        new_node->writers.store(0, std::memory_order_relaxed);
         new_node->is_leaf = old_node->is_leaf;
-        new_node->count = IndexNode::MAX_KEYS - mid;
-        
-        for (int i = 0; i < new_node->count; i++) {
-            new_node->keys[i] = old_node->keys[mid + i];
-            new_node->children[i] = old_node->children[mid + i];
-        }
-        
-        // 更新旧节点
-        old_node->count = mid;
-        
-        // 维护叶子节点链表
+
         if (old_node->is_leaf) {
+            // 叶子节点：后半部分移到新节点，新节点首键作为分隔键
+            new_node->count = old_node->count - mid;
+            for (uint32_t i = 0; i < new_node->count; i++) {
+                new_node->keys[i] = old_node->keys[mid + i];
+                new_node->children[i] = old_node->children[mid + i];
+                new_node->sizes[i] = old_node->sizes[mid + i];
+                split.bytes += new_node->sizes[i];
+            }
+            split.separator = new_node->keys[0];
+            split.count = new_node->count;
+
+            // 维护叶子节点双向链表，右兄弟的 prev 需要加锁修改
             new_node->next = old_node->next;
+            new_node->prev = node_offset;
+            if (old_node->next) {
+                IndexNode* right = get_node(old_node->next);
+                write_lock(right);
+                right->prev = new_node_offset;
+                write_unlock(right);
+            }
             old_node->next = new_node_offset;
+        } else {
+            // 内部节点：中间键上推，不保留在子节点中
+            new_node->count = old_node->count - mid - 1;
+            for (uint32_t i = 0; i < new_node->count; i++) {
+                new_node->keys[i] = old_node->keys[mid + 1 + i];
+            }
+            for (uint32_t i = 0; i <= new_node->count; i++) {
+                uint32_t count = old_node->counts[mid + 1 + i].load(std::memory_order_relaxed);
+                uint64_t bytes = old_node->bytes[mid + 1 + i].load(std::memory_order_relaxed);
+                new_node->children[i] = old_node->children[mid + 1 + i];
+                new_node->counts[i].store(count, std::memory_order_relaxed);
+                new_node->bytes[i].store(bytes, std::memory_order_relaxed);
+                split.count += count;
+                split.bytes += bytes;
+            }
+            split.separator = old_node->keys[mid];
+            new_node->next = 0;
+            new_node->prev = 0;
+        }
+
+        // 更新旧节点
+        old_node->count = mid;
+
+        return split;
+    }
+
+    // 统计键小于 key（inclusive 时为小于等于）的索引项数量和记录字节数。
+    // 计数不受版本号保护，并发进行中的插入和删除可能计入也可能不计入结果。
+    void prefix_totals(std::atomic<uint64_t>& root, uint64_t key, bool inclusive,
+                       uint64_t* count, uint64_t* bytes) {
+    restart:
+        uint64_t node_offset = root.load(std::memory_order_acquire);
+        IndexNode* node = get_node(node_offset);
+        uint64_t version = read_lock(node);
+        if (node_offset != root.load(std::memory_order_acquire)) goto restart;
+
+        *count = 0;
+        *bytes = 0;
+        while (!node->is_leaf) {
+            // 目标子树左侧的子树全部小于 key
+            uint32_t i = child_index(node, key);
+            for (uint32_t j = 0; j < i; j++) {
+                *count += node->counts[j].load(std::memory_order_acquire);
+                *bytes += node->bytes[j].load(std::memory_order_acquire);
+            }
+            uint64_t child = node->children[i];
+            if (!validate(node, version)) goto restart;
+            node = get_node(child);
+            version = read_lock(node);
+        }
+
+        uint32_t n = std::min<uint32_t>(node->count, IndexNode::MAX_KEYS);
+        for (uint32_t i = 0; i < n; i++) {
+            if (node->keys[i] < key || (inclusive && node->keys[i] == key)) {
+                (*count)++;
+                *bytes += node->sizes[i];
+            }
         }
-        
-        return new_node_offset;
+        if (!validate(node, version)) goto restart;
     }
 
-    // 查找叶子节点
-    IndexNode* find_leaf(uint32_t key) {
-        IndexNode* node = root;
+    // 按键序取第 k 个索引项（从 0 开始）。
+    // 只有根节点上的计数能说明 k 越界；下层子树放不下剩余序号时，
+    // 说明读到了并发增减中的计数，重新下降
+    bool select_entry(IndexMeta::Tree& tree, uint64_t k, uint64_t* key, uint64_t* value) {
+    restart:
+        uint64_t rank = k;
+        uint64_t node_offset = tree.root.load(std::memory_order_acquire);
+        IndexNode* node = get_node(node_offset);
+        uint64_t version = read_lock(node);
+        if (node_offset != tree.root.load(std::memory_order_acquire)) goto restart;
+
+        bool at_root = true;
         while (!node->is_leaf) {
-            int i;
-            for (i = 0; i < node->count; i++) {
-                if (key < node->keys[i]) break;
+            uint32_t n = std::min<uint32_t>(node->count, IndexNode::MAX_KEYS);
+            uint32_t i = 0;
+            uint64_t count = node->counts[0].load(std::memory_order_acquire);
+            while (i < n && rank >= count) {
+                rank -= count;
+                count = node->counts[++i].load(std::memory_order_acquire);
+            }
+            uint64_t child = node->children[i];
+            if (!validate(node, version)) goto restart;
+            if (rank >= count) {
+                if (at_root) return false;
+                goto restart;
+            }
+            node = get_node(child);
+            version = read_lock(node);
+            at_root = false;
+        }
+
+        bool found = rank < std::min<uint32_t>(node->count, IndexNode::MAX_KEYS);
+        if (found) {
+            *key = node->keys[rank];
+            *value = node->children[rank];
+        }
+        if (!validate(node, version)) goto restart;
+        if (!found && !at_root) goto restart;
+        return found;
+    }
+
+    // 在树上计算 [start_key, end_key] 内的聚合值，最小/最大键通过按序号选择得到
+    Aggregate aggregate_tree(IndexMeta::Tree& tree, uint64_t start_key, uint64_t end_key, int key_shift) {
+        Aggregate result = {0, 0, 0, 0};
+        if (start_key > end_key) return result;
+
+        uint64_t below, below_bytes, upto, upto_bytes;
+        prefix_totals(tree.root, start_key, false, &below, &below_bytes);
+        prefix_totals(tree.root, end_key, true, &upto, &upto_bytes);
+        if (upto <= below) return result;
+
+        result.count = upto - below;
+        result.total_bytes = upto_bytes - below_bytes;
+        uint64_t key, value;
+        if (select_entry(tree, below, &key, &value)) {
+            result.min_key = (uint32_t)(key >> key_shift);
+        }
+        if (select_entry(tree, upto - 1, &key, &value)) {
+            result.max_key = (uint32_t)(key >> key_shift);
+        }
+        return result;
+    }
+
+    // 并行扫描实现，分区边界通过按序号选择得到
+    void parallel_scan(int index, uint64_t start_key, uint64_t end_key,
+                       const ScanCallback& callback, size_t thread_count) {
+        static const uint64_t MIN_PARTITION = 4096;   // 分区过小时线程开销大于收益
+        static const size_t PARTITIONS_PER_THREAD = 4;
+        if (start_key > end_key) return;
+
+        IndexMeta::Tree& tree = meta->trees[index];
+        uint64_t below, upto, bytes;
+        prefix_totals(tree.root, start_key, false, &below, &bytes);
+        prefix_totals(tree.root, end_key, true, &upto, &bytes);
+        uint64_t total = upto > below ? upto - below : 0;
+
+        if (thread_count == 0) {
+            thread_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        size_t partitions = std::min<uint64_t>(thread_count * PARTITIONS_PER_THREAD,
+                                               total / MIN_PARTITION + 1);
+        thread_count = std::min(thread_count, partitions);
+
+        // bounds[p] 为分区 p 的起始键，最后一个分区结束于 end_key
+        std::vector<uint64_t> bounds(partitions);
+        bounds[0] = start_key;
+        for (size_t p = 1; p < partitions; p++) {
+            uint64_t key, value;
+            if (!select_entry(tree, below + total * p / partitions, &key, &value)) key = end_key;
+            bounds[p] = std::max(bounds[p - 1], std::min(key, end_key));
+        }
+
+        int key_shift = index == 0 ? 0 : 32;
+        std::atomic<size_t> next_partition(0);
+        auto worker = [&]() {
+            while (true) {
+                size_t p = next_partition.fetch_add(1, std::memory_order_relaxed);
+                if (p >= partitions) break;
+                bool last = p + 1 == partitions;
+                uint64_t limit = last ? end_key : bounds[p + 1];
+                if (!last && limit == bounds[p]) continue;
+
+                Cursor it(this, index);
+                it.seek(bounds[p], true);
+                for (; it.valid(); it.next()) {
+                    uint64_t key = it.entries[it.pos].first;
+                    if (last ? key > limit : key >= limit) break;
+                    callback((uint32_t)(key >> key_shift), it.record());
+                }
             }
-            node = get_node(node->children[i]);
+        };
+
+        // 单线程时直接在调用线程中扫描
+        if (thread_count <= 1) {
+            worker();
+            return;
+        }
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < thread_count; t++) {
+            workers.emplace_back(worker);
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    // 查找叶子节点，返回时 version 为叶子的乐观读版本号
+    IndexNode* find_leaf(std::atomic<uint64_t>& root, uint64_t key, uint64_t& version) {
+    restart:
+        uint64_t node_offset = root.load(std::memory_order_acquire);
+        IndexNode* node = get_node(node_offset);
+        version = read_lock(node);
+        if (node_offset != root.load(std::memory_order_acquire)) goto restart;
+
+        while (!node->is_leaf) {
+            uint64_t child = node->children[child_index(node, key)];
+            if (!validate(node, version)) goto restart;
+            node = get_node(child);
+            version = read_lock(node);
         }
         return node;
     }
 
     // 通过索引查找记录位置
     uint64_t find_by_index(uint32_t key) {
-        IndexNode* leaf = find_leaf(key);
-        for (uint32_t i = 0; i < leaf->count; i++) {
-            if (leaf->keys[i] == key) {
-                return leaf->children[i];
+        while (true) {
+            uint64_t version;
+            IndexNode* leaf = find_leaf(meta->trees[0].root, key, version);
+            uint64_t pos = 0;
+            uint32_t count = std::min<uint32_t>(leaf->count, IndexNode::MAX_KEYS);
+            for (uint32_t i = 0; i < count; i++) {
+                if (leaf->keys[i] == key) {
+                    pos = leaf->children[i];
+                    break;
+                }
+            }
+            if (validate(leaf, version)) return pos;
+        }
+    }
+
+    // 删除索引项，只从叶子中移除，不做节点合并。
+    // 与插入相同，乐观下降并登记在经过的内部节点上，只锁住目标叶子，确认找到后再更新各层计数
+    bool erase_index(IndexMeta::Tree& tree, uint64_t key) {
+        IndexNode* path[MAX_HEIGHT];
+        uint32_t slots[MAX_HEIGHT];
+    restart:
+        int depth = 0;
+        uint64_t node_offset = tree.root.load(std::memory_order_acquire);
+        IndexNode* node = get_node(node_offset);
+        uint64_t version = read_lock(node);
+        if (node_offset != tree.root.load(std::memory_order_acquire)) goto restart;
+
+        while (!node->is_leaf) {
+            if (!enter_node(node, version)) {
+                leave_path(path, depth);
+                goto restart;
+            }
+            path[depth] = node;
+            slots[depth] = child_index(node, key);
+            node = get_node(node->children[slots[depth]]);
+            depth++;
+            version = node->version.load(std::memory_order_acquire);
+            if (version & LOCKED_BIT) {
+                leave_path(path, depth);
+                goto restart;
+            }
+        }
+        if (!upgrade_lock(node, version)) {
+            leave_path(path, depth);
+            goto restart;
+        }
+
+        bool found = false;
+        for (uint32_t i = 0; i < node->count; i++) {
+            if (node->keys[i] == key) {
+                uint32_t size = node->sizes[i];
+                for (int d = 0; d < depth; d++) {
+                    path[d]->counts[slots[d]].fetch_sub(1, std::memory_order_release);
+                    path[d]->bytes[slots[d]].fetch_sub(size, std::memory_order_release);
+                }
+                for (uint32_t j = i + 1; j < node->count; j++) {
+                    node->keys[j - 1] = node->keys[j];
+                    node->children[j - 1] = node->children[j];
+                    node->sizes[j - 1] = node->sizes[j];
+                }
+                node->count--;
+                found = true;
+                break;
             }
         }
-        return 0;
+        write_unlock(node);
+        leave_path(path, depth);
+
+        return found;
     }
-};
\ No newline at end of file
+};
@@ -1,6 +1,7 @@
 #include "simple_db.h"
 #include "optimized_db.h"
 #include "indexed_db.h"
+#include "hashed_db.h"
 #include <cstring>
 
 void print_usage(const char* program) {
@@ -8,12 +9,15 @@ void print_usage(const char* program) {
     printf("Database Types:\n");
     printf("  simple     - Simple memory mapped database\n");
     printf("  optimized  - Optimized database with caching\n");
-    printf("  indexed    - B+ tree indexed database\n\n");
+    printf("  indexed    - B+ tree indexed database\n");
+    printf("  hashed     - Linear hash indexed database\n\n");
     printf("Commands:\n");
     printf("  write <data>           - Write data to database\n");
     printf("  read <id>              - Read data by ID\n");
     printf("  delete <id>            - Delete data by ID\n");
     printf("  range <start> <end>    - Range query (indexed only)\n");
+    printf("  count <start> <end>    - Count records and bytes in ID range (indexed only)\n");
+    printf("  rebuild                - Rebuild index from records (indexed only)\n");
     printf("  batch <count> <prefix> - Batch write test\n\n");
     printf("Example:\n");
     printf("  %s indexed write \"Hello World\"\n", program);
@@ -28,8 +32,10 @@ public:
     virtual bool read(uint64_t pos, void* buffer, size_t* size) = 0;
     virtual bool remove(uint64_t pos) = 0;
     virtual bool read_by_id(uint32_t id, void* buffer, size_t* size) { return false; }
-    virtual void batch_write(int count, const char* prefix) {}
+    virtual bool batch_write(int count, const char* prefix) { return false; }
     virtual void range_query(uint32_t start, uint32_t end) {}
+    virtual bool count_range(uint32_t start, uint32_t end) { return false; }
+    virtual bool rebuild_index() { return false; }
 };
 
 // SimpleDB包装器
@@ -62,7 +68,7 @@ public:
     bool remove(uint64_t pos) override {
         return db.remove(pos);
     }
-    void batch_write(int count, const char* prefix) override {
+    bool batch_write(int count, const char* prefix) override {
         std::vector<std::pair<const void*, size_t>> records;
         std::vector<uint64_t> positions;
         char buffer[1024];
@@ -81,6 +87,7 @@ public:
         for (const auto& record : records) {
             free((void*)record.first);
         }
+        return true;
     }
 };
 
@@ -101,16 +108,66 @@ public:
     bool read_by_id(uint32_t id, void* buffer, size_t* size) override {
         return db.read_by_id(id, buffer, size);
     }
+    bool batch_write(int count, const char* prefix) override {
+        std::vector<std::string> data(count);
+        std::vector<std::pair<const void*, size_t>> records;
+        std::vector<uint64_t> positions;
+        for (int i = 0; i < count; i++) {
+            data[i] = prefix + std::to_string(i);
+            records.push_back({data[i].c_str(), data[i].size() + 1});
+        }
+        db.batch_write(records, positions);
+        return true;
+    }
     void range_query(uint32_t start, uint32_t end) override {
-        auto results = db.range_query(start, end);
-        char buffer[1024];
-        size_t size;
-        
-        for (const auto& result : results) {
-            if (db.read(result.second, buffer, &size)) {
-                printf("ID=%u: %s\n", result.first, buffer);
-            }
+        // 使用游标遍历，直接读取映射区中的记录
+        for (auto it = db.seek(start); it.valid() && it.key() <= end; it.next()) {
+            RecordView rec = it.record();
+            printf("ID=%u: %.*s\n", it.key(), (int)rec.size, (const char*)rec.data);
+        }
+    }
+    bool count_range(uint32_t start, uint32_t end) override {
+        // 只访问索引节点中的子树计数，不读取记录
+        IndexedDB::Aggregate agg = db.aggregate(start, end);
+        printf("Count: %llu, bytes: %llu", (unsigned long long)agg.count,
+               (unsigned long long)agg.total_bytes);
+        if (agg.count) printf(", IDs %u..%u", agg.min_key, agg.max_key);
+        printf("\n");
+        return true;
+    }
+    bool rebuild_index() override {
+        db.rebuild_index();
+        return true;
+    }
+};
+
+// HashedDB包装器
+class HashedDBWrapper : public DBWrapper {
+    HashedDB db;
+public:
+    HashedDBWrapper() : db("hashed.db") {}
+    uint64_t write(const void* data, size_t size) override {
+        return db.write(data, size);
+    }
+    bool read(uint64_t pos, void* buffer, size_t* size) override {
+        return db.read(pos, buffer, size);
+    }
+    bool remove(uint64_t pos) override {
+        return db.remove(pos);
+    }
+    bool read_by_id(uint32_t id, void* buffer, size_t* size) override {
+        return db.read_by_id(id, buffer, size);
+    }
+    bool batch_write(int count, const char* prefix) override {
+        std::vector<std::string> data(count);
+        std::vector<std::pair<const void*, size_t>> records;
+        std::vector<uint64_t> positions;
+        for (int i = 0; i < count; i++) {
+            data[i] = prefix + std::to_string(i);
+            records.push_back({data[i].c_str(), data[i].size() + 1});
         }
+        db.batch_write(records, positions);
+        return true;
     }
 };
 
@@ -132,6 +189,8 @@ int main(int argc, char* argv[]) {
             db = std::make_unique<OptimizedDBWrapper>();
         } else if (strcmp(db_type, "indexed") == 0) {
             db = std::make_unique<IndexedDBWrapper>();
+        } else if (strcmp(db_type, "hashed") == 0) {
+            db = std::make_unique<HashedDBWrapper>();
         } else {
             printf("Unknown database type: %s\n", db_type);
             print_usage(argv[0]);
@@ -183,14 +242,35 @@ int main(int argc, char* argv[]) {
             uint32_t end = atoi(argv[4]);
             db->range_query(start, end);
 
+        } else if (strcmp(command, "count") == 0) {
+            if (argc < 5) {
+                printf("Count command requires start and end arguments\n");
+                return 1;
+            }
+            uint32_t start = atoi(argv[3]);
+            uint32_t end = atoi(argv[4]);
+            if (!db->count_range(start, end)) {
+                printf("Count not supported for %s\n", db_type);
+            }
+
+        } else if (strcmp(command, "rebuild") == 0) {
+            if (db->rebuild_index()) {
+                printf("Index rebuilt\n");
+            } else {
+                printf("Rebuild not supported for %s\n", db_type);
+            }
+
         } else if (strcmp(command, "batch") == 0) {
             if (argc < 5) {
                 printf("Batch command requires count and prefix arguments\n");
                 return 1;
             }
             int count = atoi(argv[3]);
-            db->batch_write(count, argv[4]);
-            printf("Batch write completed\n");
+            if (db->batch_write(count, argv[4])) {
+                printf("Batch write completed\n");
+            } else {
+                printf("Batch write not supported for %s\n", db_type);
+            }
 
         } else {
             printf("Unknown command: %s\n", command);
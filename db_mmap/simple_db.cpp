@@ -25,9 +25,19 @@ SimpleDB::SimpleDB(const char* filename) {
         }
     }
 
-    // 建立内存映射
-    addr = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // 预留地址空间，之后的扩展都在原地完成，已有指针不会失效
+    reserved_size = mapped_size > RESERVED_SIZE ? mapped_size : RESERVED_SIZE;
+    addr = mmap(NULL, reserved_size, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
     if (addr == MAP_FAILED) {
+        close(fd);
+        throw "Cannot reserve address space";
+    }
+
+    // 建立内存映射
+    if (mmap(addr, mapped_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(addr, reserved_size);
         close(fd);
         throw "Cannot map file";
     }
@@ -36,7 +46,7 @@ SimpleDB::SimpleDB(const char* filename) {
     if (is_new) {
         init_header();
     } else if (memcmp(header->magic, "MMDB", 4) != 0) {
-        munmap(addr, mapped_size);
+        munmap(addr, reserved_size);
         close(fd);
         throw "Invalid database file";
     }
@@ -45,7 +55,7 @@ SimpleDB::SimpleDB(const char* filename) {
 SimpleDB::~SimpleDB() {
     if (addr != MAP_FAILED) {
         msync(addr, mapped_size, MS_SYNC);
-        munmap(addr, mapped_size);
+        munmap(addr, reserved_size);
     }
     if (fd != -1) {
         close(fd);
@@ -61,21 +71,22 @@ void SimpleDB::init_header() {
 }
 
 bool SimpleDB::extend_mapping(size_t new_size) {
-    // 解除旧映射
-    munmap(addr, mapped_size);
-    
+    if (new_size > reserved_size) {
+        return false;
+    }
+
     // 扩展文件
     if (ftruncate(fd, new_size) == -1) {
         return false;
     }
 
-    // 建立新映射
-    addr = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (addr == MAP_FAILED) {
+    // 只映射新增部分，基地址不变，其他线程持有的指针仍然有效
+    if (mmap((char*)addr + mapped_size, new_size - mapped_size,
+             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, mapped_size) == MAP_FAILED) {
         return false;
     }
 
-    header = (DBHeader*)addr;
     header->size = new_size;
     mapped_size = new_size;
     return true;
@@ -26,9 +26,13 @@ struct RecordHeader {
 
 class SimpleDB {
 protected:
+    // 预留的虚拟地址空间大小，扩展映射时基地址保持不变
+    static const size_t RESERVED_SIZE = 1ULL << 36;  // 64GB
+
     int fd;               // 文件描述符
     void* addr;           // 映射基地址
     size_t mapped_size;   // 映射大小
+    size_t reserved_size; // 预留地址空间大小
     DBHeader* header;     // 文件头指针
 
 public:
@@ -3,23 +3,38 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <stdexcept>
+#include <algorithm>
+#include <vector>
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22   // Linux 5.14 起支持
+#endif
 
 class MappedFile {
 private:
+    static const size_t MIN_GROW = 1024 * 1024;          // 最小扩展步长
+    static const size_t MAX_GROW = 1024 * 1024 * 1024;   // 最大扩展步长
+
     void* addr;      // 映射的内存地址
-    size_t size;     // 文件大小
+    size_t size;     // 逻辑长度（已写入的数据）
+    size_t capacity; // 映射和文件的实际大小，写模式下关闭时截断到 size
+    int fd;          // 文件描述符，扩展文件时使用
     bool writable;   // 是否可写
 
 public:
     // 构造函数，filename: 文件名，write_mode: 是否以写模式打开
+    // 写模式下文件不存在时创建
     MappedFile(const char* filename, bool write_mode = false) 
-        : addr(nullptr), size(0), writable(write_mode) {
+        : addr(nullptr), size(0), capacity(0), fd(-1), writable(write_mode) {
         
         // 打开文件
-        int flags = write_mode ? O_RDWR : O_RDONLY;
-        int fd = open(filename, flags);
+        int flags = write_mode ? (O_RDWR | O_CREAT) : O_RDONLY;
+        fd = open(filename, flags, 0666);
         if (fd == -1) {
             throw std::runtime_error("Failed to open file");
         }
@@ -28,10 +43,13 @@ public:
             // 获取文件信息
             struct stat sb;
             if (fstat(fd, &sb) == -1) {
-                close(fd);
                 throw std::runtime_error("Failed to get file size");
             }
             size = sb.st_size;
+            capacity = size;
+            if (capacity == 0) {
+                return;  // 空文件在第一次写入时映射
+            }
 
             // 设置映射保护标志
             int prot = PROT_READ;
@@ -39,15 +57,12 @@ public:
                 prot |= PROT_WRITE;
             }
 
-            // 创建内存映射
+            // 创建内存映射，保留文件描述符用于扩展
             addr = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
             if (addr == MAP_FAILED) {
-                close(fd);
+                addr = nullptr;
                 throw std::runtime_error("Failed to map file");
             }
-
-            // 关闭文件描述符（映射仍然有效）
-            close(fd);
         } catch (...) {
             close(fd);
             throw;
@@ -60,9 +75,12 @@ public:
 
     // 移动构造函数
     MappedFile(MappedFile&& other) noexcept
-        : addr(other.addr), size(other.size), writable(other.writable) {
+        : addr(other.addr), size(other.size), capacity(other.capacity),
+          fd(other.fd), writable(other.writable) {
         other.addr = nullptr;
         other.size = 0;
+        other.capacity = 0;
+        other.fd = -1;
     }
 
     // 移动赋值运算符
@@ -71,9 +89,13 @@ public:
             cleanup();
             addr = other.addr;
             size = other.size;
+            capacity = other.capacity;
+            fd = other.fd;
             writable = other.writable;
             other.addr = nullptr;
             other.size = 0;
+            other.capacity = 0;
+            other.fd = -1;
         }
         return *this;
     }
@@ -83,12 +105,15 @@ public:
         cleanup();
     }
 
-    // 获取映射的内存地址
+    // 获取映射的内存地址，扩展容量后可能改变
     void* get_addr() const { return addr; }
     
-    // 获取文件大小
+    // 获取逻辑长度
     size_t get_size() const { return size; }
 
+    // 获取容量（已映射的大小）
+    size_t get_capacity() const { return capacity; }
+
     // 读取指定位置的数据
     bool read_at(size_t offset, void* buffer, size_t length) const {
         if (offset + length > size) {
@@ -98,32 +123,335 @@ public:
         return true;
     }
 
-    // 写入数据到指定位置
+    // 写入数据到指定位置，超出逻辑长度时自动扩展
     bool write_at(size_t offset, const void* buffer, size_t length) {
-        if (!writable || offset + length > size) {
+        if (!writable || offset + length < offset) {
+            return false;
+        }
+        if (offset + length > size && !resize(offset + length)) {
             return false;
         }
         memcpy(static_cast<char*>(addr) + offset, buffer, length);
         return true;
     }
 
+    // 追加数据到逻辑末尾，offset 返回写入位置。
+    // 容量不足时按步长成倍扩展，大多数追加只是一次内存复制
+    bool append(const void* buffer, size_t length, size_t* offset = nullptr) {
+        size_t position = size;
+        if (!write_at(position, buffer, length)) {
+            return false;
+        }
+        if (offset) {
+            *offset = position;
+        }
+        return true;
+    }
+
+    // 修改逻辑长度，需要时扩展容量；缩短时不释放容量
+    bool resize(size_t new_size) {
+        if (!writable) {
+            return false;
+        }
+        if (new_size > capacity) {
+            // 按当前容量成倍增长，限制单次步长
+            size_t step = std::min(std::max(capacity, MIN_GROW), MAX_GROW);
+            size_t target = std::max(new_size, capacity + step);
+            if (!reserve(target)) {
+                return false;
+            }
+        }
+        size = new_size;
+        return true;
+    }
+
+    // 预留容量：用 fallocate 分配磁盘空间后扩展映射，映射地址可能改变
+    bool reserve(size_t new_capacity) {
+        if (!writable) {
+            return false;
+        }
+        if (new_capacity <= capacity) {
+            return true;
+        }
+        new_capacity = (new_capacity + page_size() - 1) & ~(page_size() - 1);
+
+        // 分配磁盘空间，写入时不会因磁盘满而触发 SIGBUS；文件系统不支持时退回 ftruncate
+        if (fallocate(fd, 0, capacity, new_capacity - capacity) == -1) {
+            if ((errno != EOPNOTSUPP && errno != ENOSYS) || ftruncate(fd, new_capacity) == -1) {
+                return false;
+            }
+        }
+
+        void* new_addr;
+        if (addr) {
+            new_addr = mremap(addr, capacity, new_capacity, MREMAP_MAYMOVE);
+        } else {
+            new_addr = mmap(NULL, new_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (new_addr == MAP_FAILED) {
+            return false;
+        }
+        addr = new_addr;
+        capacity = new_capacity;
+        return true;
+    }
+
     // 同步内存到文件
     bool sync() {
+        return sync_range(0, size, false);
+    }
+
+    // 同步指定范围，async 为 true 时只发起写回不等待完成
+    bool sync_range(size_t offset, size_t length, bool async = false) {
         if (!writable) {
             return false;
         }
-        return msync(addr, size, MS_SYNC) == 0;
+        char* start;
+        size_t bytes;
+        if (!page_range(offset, length, &start, &bytes)) {
+            return offset <= size;
+        }
+        return msync(start, bytes, async ? MS_ASYNC : MS_SYNC) == 0;
+    }
+
+    // 预读指定范围：优先用 MADV_POPULATE_READ 同步建立页表，
+    // 内核不支持时退回异步的 MADV_WILLNEED
+    bool prefetch(size_t offset, size_t length) {
+        char* start;
+        size_t bytes;
+        if (!page_range(offset, length, &start, &bytes)) {
+            return offset <= size;
+        }
+        if (madvise(start, bytes, MADV_POPULATE_READ) == 0) {
+            return true;
+        }
+        return madvise(start, bytes, MADV_WILLNEED) == 0;
+    }
+
+    // 从内存中淘汰指定范围：写模式下先写回脏页，再解除页表并丢弃页缓存
+    bool evict(size_t offset, size_t length) {
+        char* start;
+        size_t bytes;
+        if (!page_range(offset, length, &start, &bytes)) {
+            return offset <= size;
+        }
+        if (writable && msync(start, bytes, MS_SYNC) != 0) {
+            return false;
+        }
+        if (madvise(start, bytes, MADV_DONTNEED) != 0) {
+            return false;
+        }
+        size_t file_offset = start - static_cast<char*>(addr);
+        return posix_fadvise(fd, file_offset, bytes, POSIX_FADV_DONTNEED) == 0;
+    }
+
+    // 统计指定范围内驻留在内存中的字节数（按页计算），失败返回 0
+    size_t resident_bytes(size_t offset, size_t length) const {
+        char* start;
+        size_t bytes;
+        if (!page_range(offset, length, &start, &bytes)) {
+            return 0;
+        }
+        std::vector<unsigned char> pages(bytes / page_size());
+        if (mincore(start, bytes, pages.data()) != 0) {
+            return 0;
+        }
+        size_t resident = 0;
+        for (unsigned char page : pages) {
+            resident += page & 1;
+        }
+        return std::min(resident * page_size(), bytes);
+    }
+
+    // 私有快照视图：MAP_PRIVATE 映射，写入只在本视图内写时复制，
+    // 自行记录修改过的页，commit 时只把这些页写回基础文件，discard 丢弃全部修改。
+    // 注意：未修改的页仍然反映基础文件的最新内容，不是时间点快照；
+    // 多个快照并行提交时应修改互不重叠的页，存在快照时不要扩展基础文件
+    class Snapshot {
+    private:
+        MappedFile* base;
+        void* addr;
+        size_t size;
+        std::vector<uint64_t> dirty;   // 修改页位图
+
+    public:
+        explicit Snapshot(MappedFile* file)
+            : base(file), addr(nullptr), size(file->size) {
+            if (size == 0) {
+                return;
+            }
+            // 基础文件只读时快照也可以写，但不能提交
+            addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file->fd, 0);
+            if (addr == MAP_FAILED) {
+                addr = nullptr;
+                throw std::runtime_error("Failed to map snapshot");
+            }
+            dirty.assign((page_count() + 63) / 64, 0);
+        }
+
+        ~Snapshot() {
+            if (addr) {
+                munmap(addr, size);
+            }
+        }
+
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        Snapshot(Snapshot&& other) noexcept
+            : base(other.base), addr(other.addr), size(other.size),
+              dirty(std::move(other.dirty)) {
+            other.addr = nullptr;
+            other.size = 0;
+        }
+
+        void* get_addr() const { return addr; }
+        size_t get_size() const { return size; }
+
+        bool read_at(size_t offset, void* buffer, size_t length) const {
+            if (offset + length > size || offset + length < offset) {
+                return false;
+            }
+            memcpy(buffer, static_cast<char*>(addr) + offset, length);
+            return true;
+        }
+
+        // 写入快照并记录修改的页，快照长度固定不能扩展
+        bool write_at(size_t offset, const void* buffer, size_t length) {
+            if (!mark_dirty(offset, length)) {
+                return false;
+            }
+            memcpy(static_cast<char*>(addr) + offset, buffer, length);
+            return true;
+        }
+
+        // 通过 get_addr 直接修改内存后，需要调用此函数登记修改范围
+        bool mark_dirty(size_t offset, size_t length) {
+            if (offset + length > size || offset + length < offset) {
+                return false;
+            }
+            if (length == 0) {
+                return true;
+            }
+            size_t first = offset / page_size();
+            size_t last = (offset + length - 1) / page_size();
+            for (size_t page = first; page <= last; page++) {
+                dirty[page / 64] |= 1ULL << (page % 64);
+            }
+            return true;
+        }
+
+        // 修改过的页数
+        size_t dirty_pages() const {
+            size_t count = 0;
+            for (uint64_t word : dirty) {
+                count += __builtin_popcountll(word);
+            }
+            return count;
+        }
+
+        // 把修改过的页写回基础文件，连续的脏页合并成一次写入。
+        // durable 为 true 时同步写回的范围。成功后快照与文件一致，修改记录清空
+        bool commit(bool durable = false) {
+            if (!base->writable || base->size < size) {
+                return false;
+            }
+            size_t pages = page_count();
+            size_t page = 0;
+            while (page < pages) {
+                if (!is_dirty(page)) {
+                    page++;
+                    continue;
+                }
+                size_t first = page;
+                while (page < pages && is_dirty(page)) {
+                    page++;
+                }
+                size_t offset = first * page_size();
+                size_t length = std::min(page * page_size(), size) - offset;
+                memcpy(static_cast<char*>(base->addr) + offset,
+                       static_cast<char*>(addr) + offset, length);
+                if (durable && !base->sync_range(offset, length, false)) {
+                    return false;
+                }
+                for (size_t i = first; i < page; i++) {
+                    dirty[i / 64] &= ~(1ULL << (i % 64));
+                }
+            }
+            return true;
+        }
+
+        // 丢弃全部修改：释放私有页，之后访问重新读取基础文件
+        bool discard() {
+            if (!addr) {
+                return true;
+            }
+            if (madvise(addr, size, MADV_DONTNEED) != 0) {
+                return false;
+            }
+            std::fill(dirty.begin(), dirty.end(), 0);
+            return true;
+        }
+
+    private:
+        size_t page_count() const {
+            return (size + page_size() - 1) / page_size();
+        }
+
+        bool is_dirty(size_t page) const {
+            return dirty[page / 64] >> (page % 64) & 1;
+        }
+    };
+
+    // 创建覆盖当前逻辑长度的私有快照，开销只是一次 mmap
+    Snapshot snapshot() {
+        return Snapshot(this);
     }
 
 private:
+    // 把范围裁剪到逻辑长度并按页对齐，范围为空时返回 false
+    bool page_range(size_t offset, size_t length, char** start, size_t* bytes) const {
+        if (!addr || offset >= size) {
+            return false;
+        }
+        length = std::min(length, size - offset);
+        if (length == 0) {
+            return false;
+        }
+        size_t begin = offset & ~(page_size() - 1);
+        size_t end = (offset + length + page_size() - 1) & ~(page_size() - 1);
+        *start = static_cast<char*>(addr) + begin;
+        *bytes = std::min(end, capacity) - begin;
+        return true;
+    }
+
+    static size_t page_size() {
+        static const size_t page = sysconf(_SC_PAGESIZE);
+        return page;
+    }
+
+    // 解除映射，写模式下把文件截断到逻辑长度
     void cleanup() {
         if (addr) {
-            munmap(addr, size);
+            munmap(addr, capacity);
             addr = nullptr;
         }
+        if (fd != -1) {
+            if (writable && capacity != size) {
+                if (ftruncate(fd, size) == -1) {
+                    std::cerr << "Failed to trim file\n";
+                }
+            }
+            close(fd);
+            fd = -1;
+        }
     }
 };
 
+// 扩展步长经由 std::min/std::max 按引用使用，需要类外定义
+const size_t MappedFile::MIN_GROW;
+const size_t MappedFile::MAX_GROW;
+
 // 使用示例
 int main() {
     try {
@@ -165,6 +493,45 @@ int main() {
             std::cout << "New data: " << buffer << std::endl;
         }
 
+        // 作为追加日志使用，容量按步长扩展，关闭时截断到实际长度
+        {
+            MappedFile log("test.log", true);
+            log.resize(0);
+            char line[64];
+            for (int i = 0; i < 100000; i++) {
+                int n = snprintf(line, sizeof(line), "log entry %d\n", i);
+                if (!log.append(line, n)) {
+                    throw std::runtime_error("Failed to append");
+                }
+            }
+            std::cout << "Log size: " << log.get_size() << " bytes, capacity: "
+                      << log.get_capacity() << " bytes\n";
+
+            // 只同步新写入的部分，然后观察驻留情况
+            log.sync_range(log.get_size() - 4096, 4096, true);
+            std::cout << "Resident: " << log.resident_bytes(0, log.get_size()) << " bytes\n";
+            log.evict(0, log.get_size());
+            std::cout << "Resident after evict: " << log.resident_bytes(0, log.get_size()) << " bytes\n";
+            log.prefetch(0, 64 * 1024);
+            std::cout << "Resident after prefetch: " << log.resident_bytes(0, log.get_size()) << " bytes\n";
+        }
+
+        // 私有快照：两个视图各自修改，一个提交，一个丢弃
+        {
+            MappedFile::Snapshot accepted = file.snapshot();
+            MappedFile::Snapshot rejected = file.snapshot();
+            accepted.write_at(0, "Snapshot", 8);
+            rejected.write_at(0, "Discard!", 8);
+            std::cout << "Dirty pages: " << accepted.dirty_pages() << std::endl;
+            rejected.discard();
+            accepted.commit(true);
+
+            if (file.read_at(0, buffer, strlen(new_data))) {
+                buffer[strlen(new_data)] = '\0';
+                std::cout << "After commit: " << buffer << std::endl;
+            }
+        }
+
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
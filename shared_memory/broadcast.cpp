@@ -0,0 +1,70 @@
+// broadcast.cpp
+#include "shared_memory.h"
+#include "broadcast.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char* argv[]) {
+    int readers = argc > 1 ? atoi(argv[1]) : 4;
+    size_t state_size = (argc > 2 ? atol(argv[2]) : 64) << 10;   // 状态大小（KB）
+    bool double_buffer = argc > 3 && atoi(argv[3]) != 0;
+    double duration = 2.0;                                        // 运行时间（秒）
+    printf("%d readers, %zu KB state, %s buffer\n", readers, state_size >> 10,
+           double_buffer ? "double" : "single");
+
+    // 共享内存开头存放结束标志，之后是广播区域
+    SharedMemory shm("/my_broadcast", 64 + Broadcast::required_size(state_size, double_buffer));
+    std::atomic<int>* stop = (std::atomic<int>*)shm.get_addr();
+    Broadcast channel((char*)shm.get_addr() + 64, shm.get_size() - 64, state_size, double_buffer);
+
+    fflush(stdout);   // 避免子进程重复输出缓冲区中的内容
+    for (int r = 0; r < readers; r++) {
+        if (fork() == 0) {
+            // 读取者：每次读到的快照中所有值都应该相同
+            uint64_t* state = (uint64_t*)malloc(state_size);
+            long reads = 0, torn = 0;
+            uint64_t last = 0;
+            while (!stop->load()) {
+                size_t length;
+                uint64_t version;
+                if (!channel.read(state, state_size, &length, &version)) {
+                    channel.wait_update(0, 100);
+                    continue;
+                }
+                for (size_t i = 1; i < length / sizeof(uint64_t); i++) {
+                    if (state[i] != state[0]) {
+                        torn++;
+                        break;
+                    }
+                }
+                if (version < last) {
+                    torn++;   // 版本号不应该倒退
+                }
+                last = version;
+                reads++;
+            }
+            printf("Reader %d: %ld snapshots, last version %llu, %ld inconsistent\n",
+                   r, reads, (unsigned long long)last, torn);
+            fflush(stdout);
+            _exit(0);
+        }
+    }
+
+    // 写入者：不停发布新状态，每次把所有值写成版本号
+    double start = monotonic_seconds();
+    uint64_t published = 0;
+    while (monotonic_seconds() - start < duration) {
+        uint64_t* state = (uint64_t*)channel.begin_write();
+        published++;
+        for (size_t i = 0; i < state_size / sizeof(uint64_t); i++) {
+            state[i] = published;
+        }
+        channel.end_write(state_size);
+    }
+    stop->store(1);
+    while (wait(NULL) > 0) {
+    }
+    printf("Writer published %llu versions (%.0f/s)\n", (unsigned long long)published,
+           published / duration);
+    return 0;
+}
@@ -0,0 +1,189 @@
+// broadcast.h
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include "shared_memory.h"
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+
+// 一个写入者、任意多个读取者的广播区域，读取者只关心最新的状态。
+// 每个缓冲区用 seqlock 保护：写入前序号变为奇数，写完变为偶数，读取者复制数据后
+// 序号没有变化才算读到一致的快照。读取者只读共享内存，不会拖慢写入者。
+// 使用两个缓冲区时写入者交替写入，读取者读的是上一次写完的缓冲区，大状态也很少需要重试
+struct BroadcastHeader {
+    static const uint32_t MAGIC = 0x42434153;   // "BCAS"
+    static const uint32_t VERSION = 1;
+
+    ShmOnce init;                  // 初始化状态，先到的进程负责初始化
+    uint32_t magic;
+    uint32_t version;
+    uint32_t buffers;              // 缓冲区个数，1 或 2
+    uint64_t capacity;             // 每个缓冲区的最大数据长度
+    uint64_t stride;               // 缓冲区间距，按缓存行对齐
+
+    alignas(64) std::atomic<uint64_t> latest;   // 最新发布的版本号，0 表示还没有数据
+    ShmEvent updated;                           // 读取者等待新版本
+};
+
+// 缓冲区头部，后面紧跟 capacity 字节的数据
+struct alignas(64) BroadcastBuffer {
+    std::atomic<uint64_t> sequence;   // 奇数表示正在写入
+    std::atomic<uint64_t> version;    // 缓冲区中数据的版本号
+    std::atomic<uint64_t> length;     // 数据长度
+};
+
+class Broadcast {
+private:
+    static const int SPIN_LIMIT = 100;   // 遇到正在写入的缓冲区时，自旋多少次后让出 CPU
+
+    BroadcastHeader* header;
+    char* buffers;
+    BroadcastBuffer* writing;   // 写入者正在写的缓冲区
+
+public:
+    // 在 memory 开始的 size 字节上创建或连接广播区域，
+    // capacity 是状态的最大长度，double_buffer 为 true 时使用两个缓冲区
+    Broadcast(void* memory, size_t size, size_t capacity, bool double_buffer = false)
+        : header((BroadcastHeader*)memory), buffers((char*)memory + sizeof(BroadcastHeader)),
+          writing(NULL) {
+        uint32_t count = double_buffer ? 2 : 1;
+        if (size < required_size(capacity, double_buffer)) {
+            fprintf(stderr, "broadcast region too small\n");
+            exit(1);
+        }
+        bool ready = header->init.run([&] {
+            header->magic = BroadcastHeader::MAGIC;
+            header->version = BroadcastHeader::VERSION;
+            header->buffers = count;
+            header->capacity = capacity;
+            header->stride = buffer_stride(capacity);
+            header->latest.store(0, std::memory_order_relaxed);
+            for (uint32_t i = 0; i < count; i++) {
+                buffer(i)->sequence.store(0, std::memory_order_relaxed);
+                buffer(i)->version.store(0, std::memory_order_relaxed);
+                buffer(i)->length.store(0, std::memory_order_relaxed);
+            }
+        });
+        if (!ready) {
+            fprintf(stderr, "timed out waiting for broadcast region initialization\n");
+            exit(1);
+        }
+        if (header->magic != BroadcastHeader::MAGIC || header->version != BroadcastHeader::VERSION ||
+            header->buffers != count || header->capacity != capacity) {
+            fprintf(stderr, "incompatible broadcast region in shared memory\n");
+            exit(1);
+        }
+    }
+
+    // 所需的共享内存大小
+    static size_t required_size(size_t capacity, bool double_buffer = false) {
+        return sizeof(BroadcastHeader) + buffer_stride(capacity) * (double_buffer ? 2 : 1);
+    }
+
+    size_t capacity() const { return header->capacity; }
+
+    // 最新发布的版本号，读取者可以先比较版本号再决定是否读取
+    uint64_t version() const {
+        return header->latest.load(std::memory_order_acquire);
+    }
+
+    // ---------- 写入者（只能有一个） ----------
+
+    // 开始写入新状态，返回可以直接写入的地址，写完后调用 end_write
+    void* begin_write() {
+        uint64_t next = header->latest.load(std::memory_order_relaxed) + 1;
+        writing = buffer(next % header->buffers);
+        uint64_t sequence = writing->sequence.load(std::memory_order_relaxed);
+        writing->sequence.store(sequence + 1, std::memory_order_relaxed);
+        // 序号变为奇数必须先于数据写入被读取者看到
+        std::atomic_thread_fence(std::memory_order_release);
+        return data(writing);
+    }
+
+    // 完成写入并发布新版本
+    void end_write(size_t length) {
+        uint64_t next = header->latest.load(std::memory_order_relaxed) + 1;
+        writing->version.store(next, std::memory_order_relaxed);
+        writing->length.store(length, std::memory_order_relaxed);
+        writing->sequence.store(writing->sequence.load(std::memory_order_relaxed) + 1,
+                                std::memory_order_release);
+        header->latest.store(next, std::memory_order_release);
+        writing = NULL;
+        header->updated.notify();
+    }
+
+    // 发布新状态，长度超过容量时返回 false
+    bool publish(const void* state, size_t length) {
+        if (length > header->capacity) {
+            return false;
+        }
+        memcpy(begin_write(), state, length);
+        end_write(length);
+        return true;
+    }
+
+    // ---------- 读取者 ----------
+
+    // 读取最新状态的一致快照，还没有数据或 buffer 不够大时返回 false。
+    // version 返回读到的版本号，可以为 NULL
+    bool read(void* buffer_out, size_t buffer_size, size_t* length, uint64_t* version_out = NULL) {
+        int spins = 0;
+        while (true) {
+            uint64_t latest = header->latest.load(std::memory_order_acquire);
+            if (latest == 0) {
+                return false;
+            }
+            BroadcastBuffer* current = buffer(latest % header->buffers);
+            uint64_t before = current->sequence.load(std::memory_order_acquire);
+            if ((before & 1) == 0) {
+                size_t size = current->length.load(std::memory_order_relaxed);
+                uint64_t version = current->version.load(std::memory_order_relaxed);
+                bool fits = size <= buffer_size;
+                if (fits) {
+                    memcpy(buffer_out, data(current), size);
+                }
+                // 数据读取必须先于再次读取序号完成
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (current->sequence.load(std::memory_order_relaxed) == before) {
+                    if (!fits) {
+                        return false;   // 确认不是读到了写了一半的长度
+                    }
+                    *length = size;
+                    if (version_out) {
+                        *version_out = version;
+                    }
+                    return true;
+                }
+            }
+            // 写入者正在改写这个缓冲区
+            if (++spins >= SPIN_LIMIT) {
+                sched_yield();
+                spins = 0;
+            }
+        }
+    }
+
+    // 等待版本号超过 known，超时返回 false
+    bool wait_update(uint64_t known, long timeout_ms = -1) {
+        return header->updated.wait([&] { return version() > known; }, timeout_ms);
+    }
+
+private:
+    static uint64_t buffer_stride(size_t capacity) {
+        return (sizeof(BroadcastBuffer) + capacity + 63) & ~(uint64_t)63;
+    }
+
+    BroadcastBuffer* buffer(uint32_t index) {
+        return (BroadcastBuffer*)(buffers + index * header->stride);
+    }
+
+    static char* data(BroadcastBuffer* buffer) {
+        return (char*)(buffer + 1);
+    }
+};
+
+#endif
@@ -0,0 +1,78 @@
+// mpmc.cpp
+#include "shared_memory.h"
+#include "mpmc_queue.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const uint64_t SLOTS = 4096;       // 队列槽数
+static const uint32_t SLOT_SIZE = 64;     // 每条消息的最大长度
+
+// 消息内容：生产者编号和序号
+struct Item {
+    int producer;
+    long sequence;
+};
+
+int main(int argc, char* argv[]) {
+    int producers = argc > 1 ? atoi(argv[1]) : 4;
+    int consumers = argc > 2 ? atoi(argv[2]) : 2;
+    long count = argc > 3 ? atol(argv[3]) : 1000000;   // 每个生产者发送的消息数
+    printf("%d producers, %d consumers, %ld messages per producer\n", producers, consumers, count);
+
+    // 共享内存开头存放消费者的统计，之后是队列
+    size_t stats_size = 64 * (consumers + 1);
+    SharedMemory shm("/my_mpmc_queue", stats_size + MpmcQueue::required_size(SLOTS, SLOT_SIZE));
+    char* base = (char*)shm.get_addr();
+    MpmcQueue queue(base + stats_size, shm.get_size() - stats_size, SLOT_SIZE);
+    std::atomic<long>* finished = (std::atomic<long>*)base;   // 已退出的生产者数
+
+    // 模拟崩溃的生产者：认领一个槽后直接退出，消费者会回收这个槽
+    if (fork() == 0) {
+        uint64_t ticket;
+        while (!queue.begin_push(&ticket)) {
+            sched_yield();
+        }
+        _exit(0);
+    }
+
+    for (int p = 0; p < producers; p++) {
+        if (fork() == 0) {
+            Item item = {p, 0};
+            for (item.sequence = 0; item.sequence < count; item.sequence++) {
+                queue.push(&item, sizeof(item)); // 队列满时等待消费者
+            }
+            finished->fetch_add(1);
+            _exit(0);
+        }
+    }
+
+    for (int c = 0; c < consumers; c++) {
+        if (fork() == 0) {
+            std::atomic<long>* received = (std::atomic<long>*)(base + 64 * (c + 1));
+            char buffer[SLOT_SIZE];
+            uint32_t length;
+            long total = 0;
+            while (true) {
+                if (queue.pop(buffer, &length, 100)) {
+                    total++;
+                } else if (finished->load() == producers && queue.empty()) {
+                    break;   // 生产者都已退出且队列为空
+                }
+            }
+            received->store(total);
+            _exit(0);
+        }
+    }
+
+    while (wait(NULL) > 0) {
+    }
+
+    long total = 0;
+    for (int c = 0; c < consumers; c++) {
+        long received = ((std::atomic<long>*)(base + 64 * (c + 1)))->load();
+        printf("Consumer %d received %ld messages\n", c, received);
+        total += received;
+    }
+    printf("Total %ld of %ld messages\n", total, producers * count);
+    return 0;
+}
@@ -0,0 +1,306 @@
+// mpmc_queue.h
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include "shared_memory.h"
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+
+// 多生产者/多消费者有界队列（Vyukov 序号环），放在共享内存段中供多个进程使用。
+// 每个槽有一个序号：序号等于位置时可写，等于位置 + 1 时可读，读完后加上容量进入下一轮。
+// 生产者和消费者各自用 CAS 推进位置，没有全局锁
+struct MpmcHeader {
+    static const uint32_t MAGIC = 0x4D504D43;   // "MPMC"
+    static const uint32_t VERSION = 2;
+
+    ShmOnce init;                  // 初始化状态，先到的进程负责初始化
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;            // 每个槽的最大消息长度
+    uint64_t capacity;             // 槽数，2 的幂
+    uint64_t stride;               // 槽间距，按缓存行对齐
+
+    alignas(64) std::atomic<uint64_t> enqueue_pos;   // 下一个可写位置
+    alignas(64) std::atomic<uint64_t> dequeue_pos;   // 下一个可读位置
+
+    ShmEvent not_empty;   // 消费者等待消息
+    ShmEvent not_full;    // 生产者等待空槽
+};
+
+// 槽头部，后面紧跟 slot_size 字节的数据
+struct MpmcSlot {
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> owner;   // 认领者：高 32 位是位置的低 32 位，低 32 位是进程号，进程号为 0 表示未认领或已被回收
+    uint32_t length;
+    uint32_t reserved;
+};
+
+class MpmcQueue {
+private:
+    static const uint32_t ABANDONED = 0xFFFFFFFF;   // 被回收的槽，消费者直接跳过
+    static const long STALL_CHECK_NS = 10000000;    // 槽停滞超过 10ms 才检查认领者
+    static const long OWNERLESS_NS = 1000000000;    // 认领后 1s 仍未登记进程号，视为已崩溃
+
+    MpmcHeader* header;
+    char* slots;
+    uint64_t mask;
+
+    // 消费者本地的停滞记录，避免每次轮询都做系统调用
+    uint64_t stalled_pos;
+    long stalled_since;
+
+public:
+    // 在 memory 开始的 size 字节上创建或连接队列，槽数取能放下的最大 2 的幂
+    MpmcQueue(void* memory, size_t size, uint32_t slot_size)
+        : header((MpmcHeader*)memory), slots((char*)memory + sizeof(MpmcHeader)),
+          stalled_pos(~(uint64_t)0), stalled_since(0) {
+        uint64_t stride = slot_stride(slot_size);
+        if (size < sizeof(MpmcHeader) + stride * 2) {
+            fprintf(stderr, "queue too small\n");
+            exit(1);
+        }
+        bool ready = header->init.run([&] {
+            uint64_t capacity = 1;
+            while (capacity * 2 * stride <= size - sizeof(MpmcHeader)) {
+                capacity *= 2;
+            }
+            header->magic = MpmcHeader::MAGIC;
+            header->version = MpmcHeader::VERSION;
+            header->slot_size = slot_size;
+            header->capacity = capacity;
+            header->stride = stride;
+            mask = capacity - 1;
+            for (uint64_t i = 0; i < capacity; i++) {
+                slot(i)->sequence.store(i, std::memory_order_relaxed);
+                slot(i)->owner.store(owner_tag(i - capacity, 0), std::memory_order_relaxed);
+            }
+            header->enqueue_pos.store(0, std::memory_order_relaxed);
+            header->dequeue_pos.store(0, std::memory_order_relaxed);
+        });
+        if (!ready) {
+            fprintf(stderr, "timed out waiting for queue initialization\n");
+            exit(1);
+        }
+        if (header->magic != MpmcHeader::MAGIC || header->version != MpmcHeader::VERSION ||
+            header->slot_size != slot_size ||
+            header->capacity * header->stride > size - sizeof(MpmcHeader)) {
+            fprintf(stderr, "incompatible queue in shared memory\n");
+            exit(1);
+        }
+        mask = header->capacity - 1;
+    }
+
+    // 容纳 slots 个槽所需的共享内存大小，slots 应为 2 的幂
+    static size_t required_size(uint64_t slots, uint32_t slot_size) {
+        return sizeof(MpmcHeader) + slots * slot_stride(slot_size);
+    }
+
+    uint64_t capacity() const { return header->capacity; }
+    uint32_t slot_size() const { return header->slot_size; }
+
+    // 所有认领过的槽都已被读取（包括回收的槽）
+    bool empty() const {
+        return header->dequeue_pos.load(std::memory_order_acquire) ==
+               header->enqueue_pos.load(std::memory_order_acquire);
+    }
+
+    // ---------- 生产者 ----------
+
+    // 认领一个槽，返回可以直接写入的地址，队列满时返回 NULL。
+    // 写完后用 ticket 调用 end_push 发布
+    void* begin_push(uint64_t* ticket) {
+        while (true) {
+            uint64_t pos = header->enqueue_pos.load(std::memory_order_relaxed);
+            MpmcSlot* cell = slot(pos);
+            uint64_t seq = cell->sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)(seq - pos);
+            if (diff < 0) {
+                return NULL;   // 槽还没被上一轮的消费者释放，队列已满
+            }
+            if (diff > 0 || !header->enqueue_pos.compare_exchange_weak(
+                                pos, pos + 1, std::memory_order_relaxed)) {
+                continue;      // 被其他生产者抢先
+            }
+
+            // 登记认领者。正常情况下原来的登记属于上一轮；如果已经是本轮或之后的位置，
+            // 说明消费者把这个槽当作崩溃回收了，放弃它重新认领
+            uint64_t previous = cell->owner.exchange(owner_tag(pos, getpid()),
+                                                     std::memory_order_acq_rel);
+            if ((int32_t)((uint32_t)(previous >> 32) - (uint32_t)pos) >= 0) {
+                continue;
+            }
+            *ticket = pos;
+            return data(cell);
+        }
+    }
+
+    // 发布 begin_push 认领的槽，唤醒一个等待的消费者
+    void end_push(uint64_t ticket, uint32_t length) {
+        MpmcSlot* cell = slot(ticket);
+        cell->length = length;
+        cell->sequence.store(ticket + 1, std::memory_order_release);
+        header->not_empty.notify(1);
+    }
+
+    // 写入一条消息，队列满或消息超过槽大小时返回 false
+    bool try_push(const void* message, uint32_t length) {
+        if (length > header->slot_size) {
+            return false;
+        }
+        uint64_t ticket;
+        void* buffer = begin_push(&ticket);
+        if (!buffer) {
+            return false;
+        }
+        memcpy(buffer, message, length);
+        end_push(ticket, length);
+        return true;
+    }
+
+    // 写入一条消息，队列满时等待，超时返回 false
+    bool push(const void* message, uint32_t length, long timeout_ms = -1) {
+        if (length > header->slot_size) {
+            return false;
+        }
+        long deadline = timeout_ms < 0 ? 0 : monotonic_ns() + timeout_ms * 1000000;
+        while (!try_push(message, length)) {
+            long left = remaining_ms(deadline, timeout_ms);
+            if (left == 0) {
+                return false;
+            }
+            header->not_full.wait([&] {
+                uint64_t pos = header->enqueue_pos.load(std::memory_order_relaxed);
+                return slot(pos)->sequence.load(std::memory_order_acquire) >= pos;
+            }, left);
+        }
+        return true;
+    }
+
+    // ---------- 消费者 ----------
+
+    // 读取一条消息到 buffer（至少 slot_size 字节），队列为空时返回 false。
+    // 遇到崩溃的生产者留下的停滞槽时会回收它
+    bool try_pop(void* buffer, uint32_t* length) {
+        while (true) {
+            uint64_t pos = header->dequeue_pos.load(std::memory_order_relaxed);
+            MpmcSlot* cell = slot(pos);
+            uint64_t seq = cell->sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)(seq - (pos + 1));
+            if (diff < 0) {
+                // 槽未发布：队列为空，或者生产者认领后还没写完
+                if (header->enqueue_pos.load(std::memory_order_relaxed) == pos ||
+                    !recover(cell, pos)) {
+                    return false;
+                }
+                continue;
+            }
+            if (diff > 0 || !header->dequeue_pos.compare_exchange_weak(
+                                pos, pos + 1, std::memory_order_relaxed)) {
+                continue;      // 被其他消费者抢先
+            }
+
+            bool abandoned = cell->length == ABANDONED;
+            if (!abandoned) {
+                *length = cell->length;
+                memcpy(buffer, data(cell), cell->length);
+            }
+            // 释放槽给下一轮的生产者
+            cell->sequence.store(pos + header->capacity, std::memory_order_release);
+            header->not_full.notify(1);
+            if (!abandoned) {
+                return true;
+            }
+        }
+    }
+
+    // 读取一条消息，队列为空时等待，超时返回 false。
+    // 队头的槽停滞时每隔一段时间醒来检查，以便回收崩溃的生产者留下的槽
+    bool pop(void* buffer, uint32_t* length, long timeout_ms = -1) {
+        long deadline = timeout_ms < 0 ? 0 : monotonic_ns() + timeout_ms * 1000000;
+        while (!try_pop(buffer, length)) {
+            long left = remaining_ms(deadline, timeout_ms);
+            if (left == 0) {
+                return false;
+            }
+            if (!empty()) {
+                left = left < 0 ? STALL_CHECK_NS / 1000000 : std::min(left, STALL_CHECK_NS / 1000000);
+            }
+            header->not_empty.wait([&] {
+                uint64_t pos = header->dequeue_pos.load(std::memory_order_relaxed);
+                return slot(pos)->sequence.load(std::memory_order_acquire) >= pos + 1;
+            }, left);
+        }
+        return true;
+    }
+
+private:
+    // 距离截止时间的毫秒数，不限时返回 -1，已超时返回 0
+    static long remaining_ms(long deadline, long timeout_ms) {
+        if (timeout_ms < 0) {
+            return -1;
+        }
+        long left = deadline - monotonic_ns();
+        return left <= 0 ? 0 : (left + 999999) / 1000000;
+    }
+
+    static uint64_t slot_stride(uint32_t slot_size) {
+        return (sizeof(MpmcSlot) + slot_size + 63) & ~(uint64_t)63;
+    }
+
+    static uint64_t owner_tag(uint64_t pos, uint32_t pid) {
+        return (pos << 32) | pid;
+    }
+
+    MpmcSlot* slot(uint64_t pos) {
+        return (MpmcSlot*)(slots + (pos & mask) * header->stride);
+    }
+
+    static char* data(MpmcSlot* cell) {
+        return (char*)(cell + 1);
+    }
+
+    // 检查停滞的槽：认领者进程已退出，或者认领后长时间没有登记进程号时，
+    // 把槽标记为已回收并发布，消费者会跳过它。返回 true 表示已回收
+    bool recover(MpmcSlot* cell, uint64_t pos) {
+        long now = monotonic_ns();
+        if (pos != stalled_pos) {
+            stalled_pos = pos;
+            stalled_since = now;
+            return false;
+        }
+        if (now - stalled_since < STALL_CHECK_NS) {
+            return false;
+        }
+
+        uint64_t owner = cell->owner.load(std::memory_order_acquire);
+        if (owner >> 32 == (uint32_t)pos) {
+            uint32_t pid = (uint32_t)owner;
+            if (pid == 0 || kill(pid, 0) == 0 || errno != ESRCH) {
+                return false;   // 已被其他消费者回收，或认领者仍然存活
+            }
+        } else if (now - stalled_since < OWNERLESS_NS) {
+            return false;       // 认领者可能还没来得及登记
+        }
+
+        // 与迟到的登记竞争：只有 owner 没变时才回收。
+        // 之后认领者不会再发布，但它可能在退出前已经正常发布过
+        if (!cell->owner.compare_exchange_strong(owner, owner_tag(pos, 0),
+                                                 std::memory_order_acq_rel) ||
+            cell->sequence.load(std::memory_order_acquire) != pos) {
+            return false;
+        }
+        cell->length = ABANDONED;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        stalled_pos = ~(uint64_t)0;
+        return true;
+    }
+};
+
+#endif
@@ -1,33 +1,50 @@
 // reader.cpp
 #include "shared_memory.h"
-#include <unistd.h>
+#include "spsc_ring.h"
+
+static const size_t RING_SIZE = 4 * 1024 * 1024;   // 与写入进程一致
+static const int BATCH = 64;                       // 每批释放的消息数
 
 int main() {
     printf("Starting reader process...\n");
-    
-    // 打开共享内存
-    SharedMemory shm("/my_shared_memory");
-    SharedData* shared_data = shm.get_data();
-    
-    // 循环读取消息
-    int last_count = 0;
-    while (last_count < 5) { // 读取5条消息后退出
-        // 检查是否有新消息
-        if (shared_data->ready == 1) {
-            printf("Read message %d: %s\n", 
-                   shared_data->message_count, 
-                   shared_data->message);
-            
-            // 更新计数
-            last_count = shared_data->message_count;
-            
-            // 清除就绪标志
-            shared_data->ready = 0;
+
+    // 打开共享内存和环形缓冲区
+    SharedMemory shm("/my_shared_memory", sizeof(SpscHeader) + RING_SIZE);
+    SpscRing ring(shm.get_addr(), shm.get_size());
+
+    // 循环读取消息，直到收到空消息
+    long received = 0;
+    long checksum = 0;
+    int pending = 0;
+    while (true) {
+        uint32_t length;
+        const void* message = ring.front(&length);
+        if (message == NULL) {
+            pending = 0;   // front 在没有数据时已经释放了空间
+            ring.wait_readable(); // 没有数据时等待写入进程唤醒
+            continue;
+        }
+        if (length == 0) {
+            ring.pop(length);
+            break;
+        }
+
+        // 前 5 条是文本消息，之后是压测数据
+        if (received < 5) {
+            printf("Read message %ld: %.*s\n", received + 1, (int)length, (const char*)message);
+        } else {
+            checksum += *(const long*)message;
+        }
+        received++;
+
+        // 批量释放空间，减少对写入进程缓存行的访问
+        ring.pop(length, ++pending == BATCH);
+        if (pending == BATCH) {
+            pending = 0;
         }
-        
-        usleep(100000); // 短暂休眠
     }
 
+    printf("Received %ld messages, checksum %ld\n", received, checksum);
     printf("Reader finished.\n");
     return 0;
-}
\ No newline at end of file
+}
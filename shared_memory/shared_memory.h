@@ -3,11 +3,21 @@
 #define SHARED_MEMORY_H
 
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>
+#include <sched.h>
+#include <atomic>
 
 // 共享内存结构体
 typedef struct {
@@ -16,44 +26,186 @@ typedef struct {
     int ready;            // 数据就绪标志
 } SharedData;
 
-// 共享内存类
+// 单调时钟，纳秒
+static inline long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// 单调时钟，秒，用于计时
+static inline double monotonic_seconds() {
+    return monotonic_ns() / 1e9;
+}
+
+// 共享内存中数据结构的一次性初始化，先到的进程负责初始化，其他进程等待。
+// 初始化期间状态字里记录初始化者的进程号，等待方发现初始化者已退出时接手重新初始化，
+// 因此初始化函数必须能在写了一半的内容上重新执行
+struct ShmOnce {
+    static const uint32_t EMPTY = 0, READY = 2;
+    static const uint32_t INITIALIZING = 0x80000000;   // 低位是初始化者的进程号
+    static const long DEFAULT_TIMEOUT_MS = 5000;
+
+    std::atomic<uint32_t> state;
+
+    // 确保 init 恰好被成功执行一次，返回 false 表示初始化者存活但超时仍未完成
+    template <typename Init>
+    bool run(Init init, long timeout_ms = DEFAULT_TIMEOUT_MS) {
+        uint32_t self = INITIALIZING | (uint32_t)getpid();
+        long deadline = monotonic_ns() + timeout_ms * 1000000;
+        uint32_t current = state.load(std::memory_order_acquire);
+        while (current != READY) {
+            bool claimed = false;
+            if (current == EMPTY) {
+                claimed = state.compare_exchange_strong(current, self);
+            } else if (owner_dead(current)) {
+                // 初始化者在完成前退出，由本进程接手
+                claimed = state.compare_exchange_strong(current, self);
+            } else if (monotonic_ns() > deadline) {
+                return false;
+            } else {
+                sched_yield();
+                current = state.load(std::memory_order_acquire);
+            }
+            if (claimed) {
+                init();
+                state.store(READY, std::memory_order_release);
+                return true;
+            }
+        }
+        return true;
+    }
+
+private:
+    static bool owner_dead(uint32_t current) {
+        pid_t pid = (pid_t)(current & ~INITIALIZING);
+        return kill(pid, 0) == -1 && errno == ESRCH;
+    }
+};
+
+// 共享内存中的等待/通知点，基于 futex，可以跨进程使用。
+// 等待方先自旋一小段时间，条件仍不满足时登记为等待者并睡眠在 sequence 上；
+// 通知方只有在有等待者时才做系统调用，空闲的一方不消耗 CPU
+struct ShmEvent {
+    alignas(64) std::atomic<uint32_t> sequence;   // futex 字，每次唤醒加一
+    std::atomic<uint32_t> waiters;                // 正在睡眠或即将睡眠的进程数
+
+    // 在修改共享状态之后调用，唤醒最多 count 个等待者
+    void notify(int count = INT_MAX) {
+        // 与等待方的登记构成 Dekker 式同步：要么通知方看到等待者，要么等待方看到新状态
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) > 0) {
+            sequence.fetch_add(1, std::memory_order_release);
+            futex(FUTEX_WAKE, count, NULL);
+        }
+    }
+
+    // 等待 ready() 为真，timeout_ms 为负数时一直等待，超时返回 false
+    template <typename Predicate>
+    bool wait(Predicate ready, long timeout_ms = -1) {
+        // 多核时先自旋，大多数情况下对方很快就会更新状态
+        for (int i = 0; i < spin_limit(); i++) {
+            if (ready()) {
+                return true;
+            }
+            cpu_relax();
+        }
+
+        long deadline = timeout_ms < 0 ? 0 : monotonic_ns() + timeout_ms * 1000000;
+        while (true) {
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+            uint32_t current = sequence.load(std::memory_order_seq_cst);
+            if (ready()) {
+                waiters.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+
+            struct timespec remaining;
+            struct timespec* timeout = NULL;
+            if (timeout_ms >= 0) {
+                long left = deadline - monotonic_ns();
+                if (left <= 0) {
+                    waiters.fetch_sub(1, std::memory_order_relaxed);
+                    return false;
+                }
+                remaining.tv_sec = left / 1000000000;
+                remaining.tv_nsec = left % 1000000000;
+                timeout = &remaining;
+            }
+            // sequence 已经变化时 futex 立即返回，不会丢失唤醒
+            futex(FUTEX_WAIT, current, timeout);
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+            if (ready()) {
+                return true;
+            }
+        }
+    }
+
+private:
+    // 跨进程使用，不能带 FUTEX_PRIVATE_FLAG
+    long futex(int op, uint32_t value, struct timespec* timeout) {
+        return syscall(SYS_futex, &sequence, op, value, timeout, NULL, 0);
+    }
+
+    static int spin_limit() {
+        static const int limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 2000 : 0;
+        return limit;
+    }
+
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+};
+
+// 共享内存类，size 为段大小，新建的段内容全部为零
 class SharedMemory {
 private:
-    SharedData* data;     // 共享内存指针
+    void* addr;          // 共享内存指针
+    size_t size;         // 映射大小
     int fd;              // 文件描述符
     const char* name;    // 共享内存名称
 
 public:
-    SharedMemory(const char* shm_name) : name(shm_name) {
+    SharedMemory(const char* shm_name, size_t shm_size = sizeof(SharedData))
+        : size(shm_size), name(shm_name) {
         fd = shm_open(name, O_CREAT | O_RDWR, 0666);
         if (fd == -1) {
             perror("shm_open failed");
             exit(1);
         }
 
-        // 设置共享内存大小
-        if (ftruncate(fd, sizeof(SharedData)) == -1) {
+        // 设置共享内存大小，只扩大不缩小，避免截断其他进程正在使用的段
+        struct stat sb;
+        if (fstat(fd, &sb) == -1) {
+            perror("fstat failed");
+            exit(1);
+        }
+        if ((size_t)sb.st_size < size && ftruncate(fd, size) == -1) {
             perror("ftruncate failed");
             exit(1);
         }
 
         // 映射共享内存
-        data = (SharedData*)mmap(NULL, sizeof(SharedData), 
-                                PROT_READ | PROT_WRITE, 
-                                MAP_SHARED, fd, 0);
-        if (data == MAP_FAILED) {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
             perror("mmap failed");
             exit(1);
         }
     }
 
     ~SharedMemory() {
-        munmap(data, sizeof(SharedData));
+        munmap(addr, size);
         close(fd);
         shm_unlink(name);
     }
 
-    SharedData* get_data() { return data; }
+    void* get_addr() { return addr; }
+    size_t get_size() const { return size; }
+    SharedData* get_data() { return (SharedData*)addr; }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,232 @@
+// shm_allocator.h
+#ifndef SHM_ALLOCATOR_H
+#define SHM_ALLOCATOR_H
+
+#include "shared_memory.h"
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 共享内存块分配器：每个 2 的幂区间再分成 4 个大小类，浪费不超过 25%。
+// 小块从 1MB 的 slab 中切分，大块直接从区域尾部分配，释放后按大小类复用，不做合并。
+// 块用相对区域起点的偏移（句柄）表示，不同进程映射到不同地址也能使用。
+// 每个块带引用计数，生产者在共享内存中直接构造消息，只把句柄交给消费者，不需要复制数据
+struct ShmBlock {
+    std::atomic<uint32_t> refcount;
+    uint32_t size_class;          // 大小类编号
+    std::atomic<uint64_t> next;   // 空闲链表中的下一个块
+};
+
+struct ShmAllocHeader {
+    static const uint32_t MAGIC = 0x534C4142;   // "SLAB"
+    static const uint32_t VERSION = 1;
+    static const int MIN_SHIFT = 6;    // 最小块 64 字节
+    static const int MAX_SHIFT = 30;   // 最大块 1GB
+    static const int CLASSES = (MAX_SHIFT - MIN_SHIFT) * 4 + 1;
+
+    ShmOnce init;                  // 初始化状态，先到的进程负责初始化
+    uint32_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t size;                 // 区域大小
+
+    alignas(64) std::atomic<uint64_t> top;   // 尚未使用空间的起点
+    ShmEvent freed;                          // 等待其他进程释放块
+
+    // 各大小类的空闲链表，高 24 位是防 ABA 的版本号，低 40 位是块偏移
+    struct alignas(64) FreeList {
+        std::atomic<uint64_t> head;
+    } free_lists[CLASSES];
+};
+
+class ShmAllocator {
+private:
+    static const uint64_t SLAB_SIZE = 1024 * 1024;   // 小块每次切分的大小
+    static const int OFFSET_BITS = 40;
+    static const uint64_t OFFSET_MASK = (1ULL << OFFSET_BITS) - 1;
+
+    ShmAllocHeader* header;
+    char* base;
+
+public:
+    // 在 memory 开始的 size 字节上创建或连接分配器
+    ShmAllocator(void* memory, size_t size)
+        : header((ShmAllocHeader*)memory), base((char*)memory) {
+        if (size < sizeof(ShmAllocHeader) + SLAB_SIZE || size > OFFSET_MASK) {
+            fprintf(stderr, "invalid allocator size\n");
+            exit(1);
+        }
+        bool ready = header->init.run([&] {
+            header->magic = ShmAllocHeader::MAGIC;
+            header->version = ShmAllocHeader::VERSION;
+            header->size = size;
+            header->top.store(sizeof(ShmAllocHeader), std::memory_order_relaxed);
+            for (int i = 0; i < ShmAllocHeader::CLASSES; i++) {
+                header->free_lists[i].head.store(0, std::memory_order_relaxed);
+            }
+        });
+        if (!ready) {
+            fprintf(stderr, "timed out waiting for allocator initialization\n");
+            exit(1);
+        }
+        if (header->magic != ShmAllocHeader::MAGIC || header->version != ShmAllocHeader::VERSION ||
+            header->size > size) {
+            fprintf(stderr, "incompatible allocator in shared memory\n");
+            exit(1);
+        }
+    }
+
+    // 分配至少 size 字节，返回句柄，引用计数为 1；空间不足返回 0
+    uint64_t allocate(size_t size) {
+        int size_class = class_of(size + sizeof(ShmBlock));
+        if (size_class >= ShmAllocHeader::CLASSES) {
+            return 0;
+        }
+        uint64_t offset = pop(size_class);
+        if (offset == 0) {
+            offset = refill(size_class);
+            if (offset == 0) {
+                return 0;
+            }
+        }
+        ShmBlock* block = get_block(offset);
+        block->size_class = size_class;
+        block->refcount.store(1, std::memory_order_relaxed);
+        return offset;
+    }
+
+    // 分配失败时等待其他进程释放块，超时返回 0
+    uint64_t allocate_wait(size_t size, long timeout_ms = -1) {
+        if (class_of(size + sizeof(ShmBlock)) >= ShmAllocHeader::CLASSES) {
+            return 0;
+        }
+        uint64_t handle = 0;
+        header->freed.wait([&] { return (handle = allocate(size)) != 0; }, timeout_ms);
+        return handle;
+    }
+
+    // 句柄对应的数据地址，每个进程各自换算
+    void* get(uint64_t handle) const {
+        return handle ? (char*)get_block(handle) + sizeof(ShmBlock) : NULL;
+    }
+
+    // 句柄可用的数据长度
+    size_t capacity(uint64_t handle) const {
+        return class_size(get_block(handle)->size_class) - sizeof(ShmBlock);
+    }
+
+    // 增加引用，例如把同一个块交给多个消费者之前
+    void retain(uint64_t handle) {
+        get_block(handle)->refcount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 释放引用，最后一个引用释放时块回到空闲链表，返回 true 表示已回收
+    bool release(uint64_t handle) {
+        ShmBlock* block = get_block(handle);
+        if (block->refcount.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return false;
+        }
+        push(block->size_class, handle, handle);
+        header->freed.notify();
+        return true;
+    }
+
+    // 尚未切分的剩余空间
+    size_t available() const {
+        return header->size - header->top.load(std::memory_order_relaxed);
+    }
+
+private:
+    ShmBlock* get_block(uint64_t offset) const {
+        return (ShmBlock*)(base + offset);
+    }
+
+    // 大小类 c 的块大小：(4 + c % 4) / 4 * 2^(MIN_SHIFT + c / 4)
+    static uint64_t class_size(int size_class) {
+        return (uint64_t)(4 + size_class % 4) << (ShmAllocHeader::MIN_SHIFT + size_class / 4 - 2);
+    }
+
+    // 能容纳 size 字节的最小大小类，超出范围时返回 CLASSES
+    static int class_of(size_t size) {
+        int size_class = 0;
+        while (size_class < ShmAllocHeader::CLASSES && class_size(size_class) < size) {
+            size_class++;
+        }
+        return size_class;
+    }
+
+    std::atomic<uint64_t>& free_list(int size_class) {
+        return header->free_lists[size_class].head;
+    }
+
+    // 从空闲链表取一个块，版本号防止 ABA
+    uint64_t pop(int size_class) {
+        std::atomic<uint64_t>& list = free_list(size_class);
+        uint64_t head = list.load(std::memory_order_acquire);
+        while (true) {
+            uint64_t offset = head & OFFSET_MASK;
+            if (offset == 0) {
+                return 0;
+            }
+            // 块可能已被其他进程取走并改写，读到的 next 不对时 CAS 会失败
+            uint64_t next = get_block(offset)->next.load(std::memory_order_relaxed);
+            uint64_t tagged = (((head >> OFFSET_BITS) + 1) << OFFSET_BITS) | next;
+            if (list.compare_exchange_weak(head, tagged, std::memory_order_acquire)) {
+                return offset;
+            }
+        }
+    }
+
+    // 把 first 到 last 已经链好的一串块放回空闲链表
+    void push(int size_class, uint64_t first, uint64_t last) {
+        std::atomic<uint64_t>& list = free_list(size_class);
+        uint64_t head = list.load(std::memory_order_relaxed);
+        while (true) {
+            get_block(last)->next.store(head & OFFSET_MASK, std::memory_order_relaxed);
+            uint64_t tagged = (((head >> OFFSET_BITS) + 1) << OFFSET_BITS) | first;
+            if (list.compare_exchange_weak(head, tagged, std::memory_order_release)) {
+                return;
+            }
+        }
+    }
+
+    // 从区域尾部分配对齐的空间，空间不足返回 0
+    uint64_t carve(uint64_t size, uint64_t align) {
+        uint64_t top = header->top.load(std::memory_order_relaxed);
+        while (true) {
+            uint64_t start = (top + align - 1) & ~(align - 1);
+            if (start + size > header->size) {
+                return 0;
+            }
+            if (header->top.compare_exchange_weak(top, start + size, std::memory_order_relaxed)) {
+                return start;
+            }
+        }
+    }
+
+    // 空闲链表为空时补充：大块直接分配，小块切分一个 slab，
+    // 返回第一个块，其余块一次性挂到空闲链表上
+    uint64_t refill(int size_class) {
+        uint64_t block_size = class_size(size_class);
+        if (block_size >= SLAB_SIZE) {
+            return carve(block_size, 4096);
+        }
+        uint64_t slab = carve(SLAB_SIZE, 4096);
+        if (slab == 0) {
+            return 0;
+        }
+        uint64_t blocks = SLAB_SIZE / block_size;
+        if (blocks > 1) {
+            uint64_t first = slab + block_size;
+            uint64_t last = slab + (blocks - 1) * block_size;
+            for (uint64_t offset = first; offset < last; offset += block_size) {
+                get_block(offset)->next.store(offset + block_size, std::memory_order_relaxed);
+            }
+            push(size_class, first, last);
+        }
+        return slab;
+    }
+};
+
+#endif
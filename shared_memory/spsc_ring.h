@@ -0,0 +1,257 @@
+// spsc_ring.h
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include "shared_memory.h"
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// 单生产者/单消费者环形缓冲区，放在共享内存段中，用于两个进程之间传递变长消息。
+// head 只由生产者写，tail 只由消费者写，各占一个缓存行，读写只需要 acquire/release。
+// 位置是单调递增的 64 位字节计数，取模得到环内偏移
+struct SpscHeader {
+    static const uint32_t MAGIC = 0x53505343;   // "SPSC"
+    static const uint32_t VERSION = 2;
+
+    ShmOnce init;                  // 初始化状态，先到的进程负责初始化
+    uint32_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t capacity;             // 数据区字节数，2 的幂
+
+    alignas(64) std::atomic<uint64_t> head;   // 已发布的写入位置
+    alignas(64) std::atomic<uint64_t> tail;   // 已释放的读取位置
+
+    ShmEvent readable;   // 消费者等待数据
+    ShmEvent writable;   // 生产者等待空间
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "跨进程原子操作需要无锁实现");
+
+class SpscRing {
+private:
+    // 每条消息前有 8 字节的记录头，记录按 8 字节对齐
+    static const uint32_t RECORD_HEADER = 8;
+    static const uint32_t PADDING = 0xFFFFFFFF;   // 环尾剩余空间不足时的跳过标记
+
+    SpscHeader* header;
+    char* data;
+    uint64_t mask;
+
+    // 生产者本地状态
+    uint64_t write_pos;      // 已写入但可能未发布的位置
+    uint64_t cached_tail;    // 上次读到的 tail，空间足够时不访问消费者的缓存行
+    uint64_t reserved_size;  // reserve 预留的记录大小
+
+    // 消费者本地状态
+    uint64_t read_pos;       // 已读取但可能未释放的位置
+    uint64_t cached_head;    // 上次读到的 head
+
+public:
+    // 在 memory 开始的 size 字节上创建或连接环形缓冲区，数据区取不超过剩余空间的最大 2 的幂
+    SpscRing(void* memory, size_t size)
+        : header((SpscHeader*)memory), data((char*)memory + sizeof(SpscHeader)),
+          write_pos(0), cached_tail(0), reserved_size(0), read_pos(0), cached_head(0) {
+        if (size < sizeof(SpscHeader) + 64) {
+            fprintf(stderr, "ring buffer too small\n");
+            exit(1);
+        }
+        bool ready = header->init.run([&] {
+            uint64_t capacity = 1;
+            while (capacity * 2 <= size - sizeof(SpscHeader)) {
+                capacity *= 2;
+            }
+            header->magic = SpscHeader::MAGIC;
+            header->version = SpscHeader::VERSION;
+            header->capacity = capacity;
+            header->head.store(0, std::memory_order_relaxed);
+            header->tail.store(0, std::memory_order_relaxed);
+        });
+        if (!ready) {
+            fprintf(stderr, "timed out waiting for ring buffer initialization\n");
+            exit(1);
+        }
+        if (header->magic != SpscHeader::MAGIC || header->version != SpscHeader::VERSION ||
+            header->capacity > size - sizeof(SpscHeader)) {
+            fprintf(stderr, "incompatible ring buffer in shared memory\n");
+            exit(1);
+        }
+        mask = header->capacity - 1;
+
+        // 连接到已有的环时从当前位置继续
+        write_pos = header->head.load(std::memory_order_acquire);
+        read_pos = header->tail.load(std::memory_order_acquire);
+        cached_tail = read_pos;
+        cached_head = write_pos;
+    }
+
+    // 单条消息的最大长度：保证环为空时带跳过标记也能放下
+    uint32_t max_message() const {
+        return (uint32_t)(header->capacity / 2 - RECORD_HEADER);
+    }
+
+    uint64_t capacity() const { return header->capacity; }
+
+    // 消费者是否已释放全部已发布的消息，任何一方都可以调用
+    bool empty() const {
+        return header->tail.load(std::memory_order_acquire) ==
+               header->head.load(std::memory_order_acquire);
+    }
+
+    // ---------- 生产者 ----------
+
+    // 预留 length 字节，返回可以直接写入的地址，空间不足返回 NULL。
+    // 写完后调用 commit，commit 之后的数据要到 publish 时才对消费者可见
+    void* reserve(uint32_t length) {
+        if (length > max_message()) {
+            return NULL;
+        }
+        uint64_t record = align(RECORD_HEADER + length);
+        uint64_t offset = write_pos & mask;
+        uint64_t contiguous = header->capacity - offset;
+        uint64_t needed = space_needed(length);
+
+        if (write_pos + needed - cached_tail > header->capacity) {
+            cached_tail = header->tail.load(std::memory_order_acquire);
+            if (write_pos + needed - cached_tail > header->capacity) {
+                // 空间不足时先发布已提交的消息，否则消费者可能一直等不到数据
+                publish();
+                return NULL;
+            }
+        }
+
+        if (record > contiguous) {
+            // 环尾放不下，写跳过标记后从头开始
+            *(uint32_t*)(data + offset) = PADDING;
+            write_pos += contiguous;
+            offset = 0;
+        }
+        *(uint32_t*)(data + offset) = length;
+        reserved_size = record;
+        return data + offset + RECORD_HEADER;
+    }
+
+    // 完成 reserve 预留的消息
+    void commit() {
+        write_pos += reserved_size;
+        reserved_size = 0;
+    }
+
+    // 发布已提交的消息，一次 release 写入让整批消息对消费者可见，
+    // 消费者在等待时唤醒它
+    void publish() {
+        header->head.store(write_pos, std::memory_order_release);
+        header->readable.notify();
+    }
+
+    // 写入一条消息，flush 为 false 时只提交不发布，用于批量发送
+    bool try_push(const void* message, uint32_t length, bool flush = true) {
+        void* buffer = reserve(length);
+        if (!buffer) {
+            return false;
+        }
+        memcpy(buffer, message, length);
+        commit();
+        if (flush) {
+            publish();
+        }
+        return true;
+    }
+
+    // 写入一条消息，空间不足时等待，超时返回 false
+    bool push(const void* message, uint32_t length, long timeout_ms = -1) {
+        while (!try_push(message, length)) {
+            if (length > max_message() || !wait_writable(length, timeout_ms)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 等待有足够的空间写入 length 字节的消息
+    bool wait_writable(uint32_t length, long timeout_ms = -1) {
+        uint64_t needed = space_needed(length);
+        return header->writable.wait([&] {
+            return write_pos + needed - header->tail.load(std::memory_order_acquire) <= header->capacity;
+        }, timeout_ms);
+    }
+
+    // 等待消费者释放全部已发布的消息
+    bool wait_empty(long timeout_ms = -1) {
+        return header->writable.wait([&] { return empty(); }, timeout_ms);
+    }
+
+    // ---------- 消费者 ----------
+
+    // 查看下一条消息，返回指向环内数据的指针，没有消息时返回 NULL。
+    // 数据在 pop 之后可能被覆盖
+    const void* front(uint32_t* length) {
+        while (true) {
+            if (read_pos == cached_head) {
+                cached_head = header->head.load(std::memory_order_acquire);
+                if (read_pos == cached_head) {
+                    // 没有数据时先释放已读取的空间，否则生产者可能一直等不到空间
+                    release();
+                    return NULL;
+                }
+            }
+            uint64_t offset = read_pos & mask;
+            uint32_t size = *(const uint32_t*)(data + offset);
+            if (size == PADDING) {
+                read_pos += header->capacity - offset;
+                continue;
+            }
+            *length = size;
+            return data + offset + RECORD_HEADER;
+        }
+    }
+
+    // 移除 front 返回的消息，flush 为 false 时延迟释放空间，用于批量接收
+    void pop(uint32_t length, bool flush = true) {
+        read_pos += align(RECORD_HEADER + length);
+        if (flush) {
+            release();
+        }
+    }
+
+    // 把已读取的空间归还给生产者，生产者在等待时唤醒它
+    void release() {
+        header->tail.store(read_pos, std::memory_order_release);
+        header->writable.notify();
+    }
+
+    // 复制一条消息到 buffer，buffer 不够大时不移除消息并返回 false
+    bool try_pop(void* buffer, uint32_t buffer_size, uint32_t* length) {
+        const void* message = front(length);
+        if (!message || *length > buffer_size) {
+            return false;
+        }
+        memcpy(buffer, message, *length);
+        pop(*length);
+        return true;
+    }
+
+    // 等待有新消息发布，超时返回 false
+    bool wait_readable(long timeout_ms = -1) {
+        return header->readable.wait([&] {
+            return header->head.load(std::memory_order_acquire) != read_pos;
+        }, timeout_ms);
+    }
+
+private:
+    // 写入 length 字节的消息需要的空间，包括环尾放不下时跳过的部分
+    uint64_t space_needed(uint32_t length) const {
+        uint64_t record = align(RECORD_HEADER + length);
+        uint64_t contiguous = header->capacity - (write_pos & mask);
+        return record <= contiguous ? record : contiguous + record;
+    }
+
+    static uint64_t align(uint64_t size) {
+        return (size + 7) & ~(uint64_t)7;
+    }
+};
+
+#endif
@@ -1,38 +1,42 @@
 // writer.cpp
 #include "shared_memory.h"
-#include <unistd.h>
+#include "spsc_ring.h"
 
-int main() {
+static const size_t RING_SIZE = 4 * 1024 * 1024;   // 环形缓冲区数据区大小
+static const int BATCH = 64;                       // 每批发布的消息数
+
+int main(int argc, char* argv[]) {
     printf("Starting writer process...\n");
-    
-    // 创建共享内存
-    SharedMemory shm("/my_shared_memory");
-    SharedData* shared_data = shm.get_data();
-    
-    // 初始化共享数据
-    shared_data->message_count = 0;
-    shared_data->ready = 0;
+    long count = argc > 1 ? atol(argv[1]) : 1000000;   // 压测消息数
+
+    // 创建共享内存和环形缓冲区
+    SharedMemory shm("/my_shared_memory", sizeof(SpscHeader) + RING_SIZE);
+    SpscRing ring(shm.get_addr(), shm.get_size());
 
-    // 循环写入消息
+    // 写入几条文本消息
+    char message[1024];
     for (int i = 1; i <= 5; i++) {
-        // 等待读取进程处理完前一条消息
-        while (shared_data->ready == 1) {
-            usleep(1000); // 短暂休眠
-        }
+        int length = snprintf(message, sizeof(message), "Message %d from writer", i);
+        ring.push(message, length); // 缓冲区满时等待读取进程释放空间
+        printf("Wrote message: %s\n", message);
+    }
 
-        // 写入新消息
-        snprintf(shared_data->message, sizeof(shared_data->message), 
-                "Message %d from writer", i);
-        shared_data->message_count = i;
-        
-        // 设置就绪标志
-        shared_data->ready = 1;
-        
-        printf("Wrote message: %s\n", shared_data->message);
-        
-        sleep(1); // 等待1秒
+    // 批量写入小消息，每 BATCH 条发布一次
+    double start = monotonic_seconds();
+    for (long i = 0; i < count; i++) {
+        while (!ring.try_push(&i, sizeof(i), (i + 1) % BATCH == 0)) {
+            ring.wait_writable(sizeof(i));
+        }
     }
+    ring.publish();
+
+    // 空消息表示结束
+    ring.push("", 0);
+    double elapsed = monotonic_seconds() - start;
+    printf("Wrote %ld messages in %.3f s (%.1f M/s)\n", count, elapsed, count / elapsed / 1e6);
 
+    // 等待读取进程取完数据再退出（析构时会删除共享内存）
+    ring.wait_empty();
     printf("Writer finished.\n");
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,69 @@
+// zero_copy.cpp
+#include "shared_memory.h"
+#include "spsc_ring.h"
+#include "shm_allocator.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const size_t RING_SIZE = 64 * 1024;              // 只传递句柄，环形缓冲区不需要很大
+static const size_t POOL_SIZE = 256 * 1024 * 1024;      // 分配器区域大小
+
+int main(int argc, char* argv[]) {
+    long count = argc > 1 ? atol(argv[1]) : 100;                  // 消息数
+    size_t message_size = (argc > 2 ? atol(argv[2]) : 8) << 20;   // 每条消息的大小（MB）
+    printf("Sending %ld messages of %zu MB\n", count, message_size >> 20);
+
+    // 共享内存开头是环形缓冲区，之后是分配器
+    size_t ring_bytes = sizeof(SpscHeader) + RING_SIZE;
+    SharedMemory shm("/my_zero_copy", ring_bytes + POOL_SIZE);
+    SpscRing ring(shm.get_addr(), ring_bytes);
+    ShmAllocator pool((char*)shm.get_addr() + ring_bytes, POOL_SIZE);
+
+    fflush(stdout);   // 避免子进程重复输出缓冲区中的内容
+    if (fork() == 0) {
+        // 消费者：通过句柄直接读取共享内存中的消息，用完后释放引用
+        long received = 0;
+        uint64_t checksum = 0;
+        while (true) {
+            uint64_t handle;
+            uint32_t length;
+            while (!ring.try_pop(&handle, sizeof(handle), &length)) {
+                ring.wait_readable();
+            }
+            if (handle == 0) {
+                break;
+            }
+            const uint64_t* words = (const uint64_t*)pool.get(handle);
+            for (size_t i = 0; i < message_size / sizeof(uint64_t); i++) {
+                checksum += words[i];
+            }
+            pool.release(handle);
+            received++;
+        }
+        printf("Consumer received %ld messages, checksum %llu\n", received,
+               (unsigned long long)checksum);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    // 生产者：在共享内存中直接构造消息，只发送 8 字节的句柄
+    double start = monotonic_seconds();
+    uint64_t expected = 0;
+    for (long n = 0; n < count; n++) {
+        uint64_t handle = pool.allocate_wait(message_size); // 块都在消费者手中时等它释放
+        uint64_t* words = (uint64_t*)pool.get(handle);
+        for (size_t i = 0; i < message_size / sizeof(uint64_t); i++) {
+            words[i] = n + i;
+            expected += n + i;
+        }
+        ring.push(&handle, sizeof(handle));
+    }
+    uint64_t end = 0;
+    ring.push(&end, sizeof(end));
+    wait(NULL);
+
+    double elapsed = monotonic_seconds() - start;
+    printf("Expected checksum %llu, %.1f MB/s\n", (unsigned long long)expected,
+           count * (message_size >> 20) / elapsed);
+    return 0;
+}